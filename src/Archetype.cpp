@@ -1,190 +1,841 @@
 #include "Archetype.h"
+#include "EntityTable.h"
+#include "Serialization.h"
 
 namespace ecs
 {
     Archetype::~Archetype()
     {
+        if (m_trivially_destructible)
+        {
+            return;
+        }
         //! call all dtors
-        for (int comp_i = 0; comp_i < m_count; ++comp_i)
+        for (std::size_t comp_i = 0; comp_i < m_count; ++comp_i)
         {
-            auto &chunk = m_buffer_stable.at(getArrayIndex(comp_i));
-            auto entity_offset = getIndexInArray(comp_i);
-            for (auto &rtti : m_type_info)
-            {
-                auto obj_p = chunk.data() + entity_offset + m_type2offsets.at(rtti.id);
-                rtti.v_table->dtor(obj_p);
-            }
+            destroyBlock(comp_i);
         }
     }
 
-    void Archetype::registerComps(std::vector<CompTypeInfo> type_info)
+    void Archetype::setChunkPool(ChunkPool &pool)
+    {
+        assert(m_buffer_stable.empty());
+        m_chunk_pool = &pool;
+    }
+
+    void Archetype::setWorldTick(const Tick &tick)
+    {
+        m_world_tick = &tick;
+    }
+
+    void Archetype::setEntityTable(EntityTable &table, ArchetypeIndex self)
+    {
+        assert(m_count == 0);
+        m_entity_table = &table;
+        m_index = self;
+    }
+
+    void Archetype::addChunk()
+    {
+        assert(m_chunk_pool); //! the pool has to be set first
+        m_buffer_stable.emplace_back(*m_chunk_pool);
+        m_changed_ticks.resize(m_buffer_stable.size() * m_type_info.size(), 0);
+        m_added_ticks.resize(m_buffer_stable.size() * m_type_info.size(), 0);
+        m_chunk_ticks.resize(m_buffer_stable.size(), 0);
+    }
+
+    void Archetype::popChunk()
+    {
+        m_buffer_stable.pop_back();
+        m_changed_ticks.resize(m_buffer_stable.size() * m_type_info.size());
+        m_added_ticks.resize(m_buffer_stable.size() * m_type_info.size());
+        m_chunk_ticks.resize(m_buffer_stable.size());
+    }
+
+    Tick Archetype::currentTick() const
+    {
+        return m_world_tick ? *m_world_tick : 0;
+    }
+
+    std::size_t Archetype::tickIndex(std::size_t chunk_i, int type_id) const
+    {
+        assert(getColumn(type_id).offset < SHARED_COLUMN); //! tags and shared components have no ticks
+        return chunk_i * m_type_info.size() + getColumn(type_id).type_index;
+    }
+
+    void Archetype::markBlocks(std::size_t comp_begin, std::size_t comp_end, bool added)
+    {
+        if (comp_begin == comp_end)
+        {
+            return;
+        }
+        auto tick = currentTick();
+        std::fill(m_chunk_ticks.begin() + getArrayIndex(comp_begin), m_chunk_ticks.begin() + getArrayIndex(comp_end - 1) + 1, tick);
+        auto begin = getArrayIndex(comp_begin) * m_type_info.size();
+        auto end = (getArrayIndex(comp_end - 1) + 1) * m_type_info.size();
+        std::fill(m_changed_ticks.begin() + begin, m_changed_ticks.begin() + end, tick);
+        if (added)
+        {
+            std::fill(m_added_ticks.begin() + begin, m_added_ticks.begin() + end, tick);
+        }
+    }
+
+    void Archetype::markChanged(std::size_t comp_index, int type_id)
+    {
+        m_changed_ticks[tickIndex(getArrayIndex(comp_index), type_id)] = currentTick();
+    }
+
+    void Archetype::markAdded(std::size_t comp_index, int type_id)
+    {
+        auto tick_i = tickIndex(getArrayIndex(comp_index), type_id);
+        m_changed_ticks[tick_i] = currentTick();
+        m_added_ticks[tick_i] = currentTick();
+    }
+
+    Tick Archetype::changedTick(std::size_t chunk_i, int type_id) const
+    {
+        return m_changed_ticks.at(tickIndex(chunk_i, type_id));
+    }
+
+    Tick Archetype::addedTick(std::size_t chunk_i, int type_id) const
+    {
+        return m_added_ticks.at(tickIndex(chunk_i, type_id));
+    }
+
+    void Archetype::registerComps(std::vector<CompTypeInfo> type_info, ChunkLayout layout)
     {
         m_type_info = type_info;
+        m_layout = layout;
 
-        std::size_t offset = 0;
+        int max_id = -1;
         for (auto &comp_rtti : m_type_info)
         {
-            m_type2offsets[comp_rtti.id] = offset;
+            max_id = std::max(max_id, comp_rtti.id);
+        }
+        m_columns.assign(max_id + 1, {.offset = MISSING_COLUMN});
+        m_type2offsets.resize(m_type_info.size());
+
+        std::size_t offset = 0;
+        for (std::size_t type_i = 0; type_i < m_type_info.size(); ++type_i)
+        {
+            auto &comp_rtti = m_type_info[type_i];
+            m_columns[comp_rtti.id].type_index = type_i;
+            m_type2offsets[type_i] = offset;
             offset += comp_rtti.size;
             m_total_size += comp_rtti.size;
+            m_trivially_copyable &= comp_rtti.trivially_copyable;
+            m_trivially_destructible &= comp_rtti.trivially_destructible;
         }
 
-        auto max_align = m_type_info[0].align;
+        auto max_align = m_type_info.empty() ? 1 : m_type_info[0].align;
         m_padding = (max_align - (offset % max_align)) % max_align;
         m_total_size += m_padding;
+
+        if (m_layout == ChunkLayout::AoS)
+        {
+            m_blocks_per_chunk = m_total_size > 0 ? COMPONENT_CHUNK_SIZE / m_total_size : COMPONENT_CHUNK_SIZE;
+            for (std::size_t type_i = 0; type_i < m_type_info.size(); ++type_i)
+            {
+                auto &column = m_columns[m_type_info[type_i].id];
+                column.offset = m_type2offsets[type_i];
+                column.stride = m_total_size;
+            }
+            return;
+        }
+
+        //! SoA: every column may need up to COLUMN_ALIGNMENT bytes to get aligned, the rest is split between blocks
+        std::size_t alignment_reserve = m_type_info.size() * COLUMN_ALIGNMENT;
+        assert(alignment_reserve < COMPONENT_CHUNK_SIZE);
+        m_blocks_per_chunk = offset > 0 ? (COMPONENT_CHUNK_SIZE - alignment_reserve) / offset : COMPONENT_CHUNK_SIZE;
+
+        std::size_t column_offset = 0;
+        for (auto &comp_rtti : m_type_info)
+        {
+            column_offset = (column_offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+            auto &column = m_columns[comp_rtti.id];
+            column.offset = column_offset;
+            column.stride = comp_rtti.size;
+            column_offset += comp_rtti.size * m_blocks_per_chunk;
+        }
+        assert(column_offset <= COMPONENT_CHUNK_SIZE); //! NO DATA OUTSIDE OF THE CHUNK!
     }
 
-    std::byte *Archetype::allocateNewEntity(std::size_t entity_id)
+    void Archetype::registerTags(const ArchetypeId &signature)
     {
-        if (needsAnotherChunk())
+        for (auto comp_id : signature.ids())
         {
-            m_buffer_stable.emplace_back(); //! create new chunk
-            m_count_last_chunk = 0;
+            if (hasComponent(comp_id))
+            {
+                continue;
+            }
+            if (comp_id >= m_columns.size())
+            {
+                m_columns.resize(comp_id + 1, {.offset = MISSING_COLUMN});
+            }
+            m_columns[comp_id] = {.offset = TAG_COLUMN};
+        }
+    }
+
+    void Archetype::setSharedValues(std::vector<SharedValue> values)
+    {
+        assert(std::is_sorted(values.begin(), values.end(), [](auto &first, auto &second)
+                              { return first.id < second.id; }));
+        m_shared_values = std::move(values);
+        for (auto &value : m_shared_values)
+        {
+            if (static_cast<std::size_t>(value.id) >= m_columns.size())
+            {
+                m_columns.resize(value.id + 1, {.offset = MISSING_COLUMN});
+            }
+            m_columns[value.id] = {.offset = SHARED_COLUMN};
         }
+    }
 
-        auto &chunk = m_buffer_stable.at(getArrayIndex(m_count));
-        auto entity_offset = getIndexInArray(m_count);
+    const std::vector<Archetype::SharedValue> &Archetype::sharedValues() const
+    {
+        return m_shared_values;
+    }
+
+    std::size_t Archetype::pushBackBlock(std::size_t entity_id)
+    {
+        if (m_count_last_chunk == getBlocksPerChunk())
+        {
+            m_count_last_chunk = 0; //! last chunk is full so we continue in the next one
+        }
+        if (needsAnotherChunk())
+        {
+            addChunk(); //! create new chunk
+        }
 
-        //! bookkeeping
-        m_entities[entity_id] = m_buffer2entity_id.size();
+        auto comp_i = m_count;
         m_buffer2entity_id.push_back(entity_id);
 
         m_count++;
         m_count_last_chunk++;
-        return chunk.data() + entity_offset;
+        assert(getIndexInArray(m_count - 1) == m_count_last_chunk - 1);
+        setLocation(comp_i);
+        markBlocks(comp_i, comp_i + 1, false);
+        return comp_i;
     }
-    void Archetype::addEntity2(std::size_t entity_id, std::vector<std::byte> data)
+
+    std::size_t Archetype::pushBackBlocks(std::span<const EntityId> ids)
     {
-        assert(!m_entities.contains(entity_id));
-        assert(data.size() == m_total_size);
+        auto first_comp_i = m_count;
+        auto new_count = m_count + ids.size();
 
-        if (needsAnotherChunk())
+        //! create all needed chunks up front
+        while (m_buffer_stable.size() < getArrayIndex(new_count - 1) + 1)
         {
-            m_buffer_stable.emplace_back(); //! create new chunk
-            m_count_last_chunk = 0;
+            addChunk();
         }
 
-        auto &chunk = m_buffer_stable.at(getArrayIndex(m_count));
-        auto entity_offset = getIndexInArray(m_count);
+        m_buffer2entity_id.insert(m_buffer2entity_id.end(), ids.begin(), ids.end());
 
-        //! move all components construct in their chunk
+        m_count = new_count;
+        m_count_last_chunk = m_count - (usedChunkCount() - 1) * getBlocksPerChunk();
+        markBlocks(first_comp_i, new_count, false);
+        return first_comp_i;
+    }
+
+    void Archetype::eraseBlock(std::size_t comp_i)
+    {
+        assert(m_count > 0 && m_count_last_chunk > 0);
+
+        //! if removing last component, we do not swap!
+        //! the record of the erased entity is left alone, it is either destroyed or already points elsewhere
+        if (comp_i != m_count - 1)
+        {
+            //! move from end to created hole
+            moveBlock(comp_i, m_count - 1);
+            markBlocks(comp_i, comp_i + 1, false);
+            m_buffer2entity_id.at(comp_i) = m_buffer2entity_id.at(m_count - 1);
+            setLocation(comp_i);
+        }
+
+        //! pop
+        m_buffer2entity_id.pop_back();
+        m_count--;
+        m_count_last_chunk--;
+        if (m_count_last_chunk == 0 && m_count > 0)
+        {
+            m_count_last_chunk = getBlocksPerChunk(); //! previous chunk is full and becomes the last one
+        }
+
+        //! one empty chunk is kept so that adding and removing around a chunk boundary does not thrash the pool
+        while (m_buffer_stable.size() > usedChunkCount() + 1)
+        {
+            popChunk();
+        }
+    }
+
+    void Archetype::moveBlock(std::size_t dest_i, std::size_t src_i)
+    {
+        if (m_trivially_copyable && m_layout == ChunkLayout::AoS)
+        {
+            //! whole block at once
+            const Column block{.offset = 0, .stride = m_total_size};
+            std::memcpy(getComponentData(dest_i, block), std::as_const(*this).getComponentData(src_i, block), m_total_size);
+            return;
+        }
+
+        //! sources are only read where possible, so that a chunk shared with a fork is not copied for that
         for (auto &type : m_type_info)
         {
-            auto dest_p = chunk.data() + entity_offset + m_type2offsets.at(type.id);
-            auto src_p = data.data() + m_type2offsets.at(type.id);
-            type.v_table->move(dest_p, src_p);
+            const auto &column = getColumn(type.id);
+            if (type.trivially_copyable)
+            {
+                std::memcpy(getComponentData(dest_i, column), std::as_const(*this).getComponentData(src_i, column), type.size);
+            }
+            else
+            {
+                type.v_table->move(getComponentData(dest_i, column), getComponentData(src_i, column));
+            }
         }
+    }
 
-        m_entities[entity_id] = m_buffer2entity_id.size();
-        m_buffer2entity_id.push_back(entity_id);
+    void Archetype::destroyBlock(std::size_t comp_i)
+    {
+        if (m_trivially_destructible)
+        {
+            return;
+        }
+        for (auto &type : m_type_info)
+        {
+            if (!type.trivially_destructible)
+            {
+                type.v_table->dtor(getComponentData(comp_i, type.id));
+            }
+        }
+    }
 
-        m_count++;
-        m_count_last_chunk++;
-        assert(getIndexInArray(m_count - 1) == (m_count_last_chunk - 1) * m_total_size);
+    std::size_t Archetype::allocateNewEntity(std::size_t entity_id)
+    {
+        return pushBackBlock(entity_id);
     }
 
-    std::vector<std::byte> Archetype::removeEntityAndGetData(int entity_id)
+    std::byte *Archetype::getComponentData(std::size_t comp_index, int type_id)
     {
-        assert(m_count > 0);
+        return getComponentData(comp_index, getColumn(type_id));
+    }
 
-        auto comp_i = m_entities.at(entity_id);
+    std::byte *Archetype::getComponentData(std::size_t comp_index, const Column &column)
+    {
+        assert(column.offset < SHARED_COLUMN); //! tags and shared components have no storage in blocks
+        auto &chunk = m_buffer_stable.at(getArrayIndex(comp_index));
+        return chunk.data() + column.offset + getIndexInArray(comp_index) * column.stride;
+    }
 
-        auto entity_offset = getIndexInArray(comp_i);
-        auto &chunk = m_buffer_stable.at(getArrayIndex(comp_i));
-        assert(m_count_last_chunk > 0);
+    const std::byte *Archetype::getComponentData(std::size_t comp_index, const Column &column) const
+    {
+        assert(column.offset < SHARED_COLUMN);
+        auto &chunk = m_buffer_stable.at(getArrayIndex(comp_index));
+        return chunk.data() + column.offset + getIndexInArray(comp_index) * column.stride;
+    }
+
+    const Archetype::Column &Archetype::getColumn(int type_id) const
+    {
+        assert(hasComponent(type_id));
+        return m_columns[type_id];
+    }
+
+    bool Archetype::hasComponent(int type_id) const
+    {
+        return static_cast<std::size_t>(type_id) < m_columns.size() && m_columns[type_id].offset != MISSING_COLUMN;
+    }
+
+    Archetype::Edge Archetype::makeEdge(Archetype &target, ArchetypeIndex target_index) const
+    {
+        Edge edge{.target = &target, .target_index = target_index};
+        for (auto &rtti : m_type_info)
+        {
+            if (target.hasComponent(rtti.id))
+            {
+                edge.transfers.push_back({.v_table = rtti.v_table,
+                                          .src_column = getColumn(rtti.id),
+                                          .dst_column = target.getColumn(rtti.id),
+                                          .size = rtti.size,
+                                          .trivially_copyable = rtti.trivially_copyable});
+            }
+            else if (!rtti.trivially_destructible)
+            {
+                edge.drops.push_back({.v_table = rtti.v_table, .src_column = getColumn(rtti.id)});
+            }
+        }
+        return edge;
+    }
+
+    std::size_t Archetype::moveEntity(std::size_t entity_id, const Edge &edge)
+    {
+        assert(edge.target != this);
+
+        auto comp_i = getBlockIndex(entity_id);
+        auto new_comp_i = edge.target->allocateNewEntity(entity_id);
+        transferBlock(comp_i, new_comp_i, edge);
+
+        eraseBlock(comp_i);
+        return new_comp_i;
+    }
+
+    std::size_t Archetype::moveEntities(std::span<const EntityId> ids, const Edge &edge)
+    {
+        assert(edge.target != this);
+        if (ids.empty())
+        {
+            return edge.target->m_count;
+        }
+
+        auto first_comp_i = edge.target->pushBackBlocks(ids);
+        for (std::size_t i = 0; i < ids.size(); ++i)
+        {
+            //! erasing swaps blocks around, so the index has to be looked up each time
+            //! the record still points here until the block is erased
+            auto comp_i = getBlockIndex(ids[i]);
+            transferBlock(comp_i, first_comp_i + i, edge);
+            eraseBlock(comp_i);
+            edge.target->setLocation(first_comp_i + i);
+        }
+        return first_comp_i;
+    }
+
+    void Archetype::transferBlock(std::size_t comp_i, std::size_t new_comp_i, const Edge &edge)
+    {
+        auto &target = *edge.target;
+        for (auto &transfer : edge.transfers)
+        {
+            auto dest_p = target.getComponentData(new_comp_i, transfer.dst_column);
+            //! the source is only read, a chunk shared with a fork stays shared (chunks with other components never are)
+            if (transfer.trivially_copyable)
+            {
+                std::memcpy(dest_p, std::as_const(*this).getComponentData(comp_i, transfer.src_column), transfer.size);
+            }
+            else
+            {
+                transfer.v_table->move(dest_p, getComponentData(comp_i, transfer.src_column));
+            }
+        }
+        for (auto &drop : edge.drops)
+        {
+            drop.v_table->dtor(getComponentData(comp_i, drop.src_column));
+        }
+    }
+
+    std::size_t Archetype::getBlockIndex(std::size_t entity_id) const
+    {
+        auto &entity = std::as_const(*m_entity_table).at(entity_id);
+        assert(entity.archetype == m_index);
+        return entity.chunk * getBlocksPerChunk() + entity.row;
+    }
+
+    void Archetype::setLocation(std::size_t comp_i)
+    {
+        assert(m_entity_table); //! the table has to be set first
+        auto &entity = m_entity_table->at(m_buffer2entity_id[comp_i]);
+        entity.archetype = m_index;
+        entity.chunk = static_cast<std::uint32_t>(getArrayIndex(comp_i));
+        entity.row = static_cast<std::uint32_t>(getIndexInArray(comp_i));
+    }
+
+    void Archetype::addEntity2(std::size_t entity_id, std::vector<std::byte> data)
+    {
+        assert(data.size() == m_total_size);
+
+        auto comp_i = pushBackBlock(entity_id);
+
+        //! move all components construct in their chunk
+        for (std::size_t type_i = 0; type_i < m_type_info.size(); ++type_i)
+        {
+            auto &type = m_type_info[type_i];
+            auto src_p = data.data() + m_type2offsets[type_i];
+            type.v_table->move(getComponentData(comp_i, type.id), src_p);
+        }
+        markBlocks(comp_i, comp_i + 1, true);
+    }
+
+    std::vector<std::byte> Archetype::removeEntityAndGetData(std::size_t entity_id)
+    {
+        assert(m_count > 0);
+
+        auto comp_i = getBlockIndex(entity_id);
 
         std::vector<std::byte> components(m_total_size);
         //! move the removed comps into returned buffer components (this calls their destructors)
-        for (auto &type : m_type_info)
+        for (std::size_t type_i = 0; type_i < m_type_info.size(); ++type_i)
         {
-            auto dest_p = components.data() + m_type2offsets.at(type.id);
-            auto comp_p = chunk.data() + entity_offset + m_type2offsets.at(type.id);
-            type.v_table->move(dest_p, comp_p);
+            auto &type = m_type_info[type_i];
+            auto dest_p = components.data() + m_type2offsets[type_i];
+            type.v_table->move(dest_p, getComponentData(comp_i, type.id));
         }
 
-        bool is_last_in_chunk = getIndexInArray(m_count - 1) == getIndexInArray(comp_i);
-        bool is_last_chunk = getArrayIndex(m_count - 1) == getArrayIndex(comp_i);
-        //! if removing last component, we do not swap!
-        if (!(is_last_in_chunk && is_last_chunk))
+        eraseBlock(comp_i);
+        return components;
+    }
+
+    void Archetype::removeEntity2(std::size_t entity_id)
+    {
+        assert(m_count > 0);
+
+        auto comp_i = getBlockIndex(entity_id);
+
+        //! destroy the removed comps
+        destroyBlock(comp_i);
+
+        eraseBlock(comp_i);
+    }
+
+    bool Archetype::empty() const
+    {
+        return m_count == 0;
+    }
+
+    void Archetype::forkFrom(const Archetype &source)
+    {
+        assert(m_count == 0 && m_layout == source.m_layout && m_type_info.size() == source.m_type_info.size());
+        auto chunk_count = source.usedChunkCount();
+        for (std::size_t chunk_i = 0; chunk_i < chunk_count; ++chunk_i)
         {
-            assert(getIndexInArray(m_count - 1) == (m_count_last_chunk - 1) * m_total_size);
-            auto &last_chunk = m_buffer_stable.at(getArrayIndex(m_count - 1));
-            auto start_comp_p = chunk.data() + entity_offset;
-            auto last_comp_p = last_chunk.data() + (m_count_last_chunk - 1) * m_total_size;
-            //! move from end to created spot
+            if (m_trivially_copyable) //! memcpy on the first write is a valid copy
+            {
+                m_buffer_stable.push_back(source.m_buffer_stable[chunk_i].share());
+                continue;
+            }
+            addChunk();
+            auto src_data = source.m_buffer_stable[chunk_i].data();
+            auto dest_data = m_buffer_stable.back().data();
+            std::size_t block_count = chunk_i + 1 < chunk_count ? getBlocksPerChunk() : source.m_count_last_chunk;
             for (auto &type : m_type_info)
             {
-                type.v_table->move(start_comp_p + m_type2offsets.at(type.id), last_comp_p + m_type2offsets.at(type.id));
+                const auto &column = m_columns[type.id];
+                for (std::size_t row = 0; row < block_count; ++row)
+                {
+                    auto offset = column.offset + row * column.stride;
+                    if (type.trivially_copyable)
+                    {
+                        std::memcpy(dest_data + offset, src_data + offset, type.size);
+                    }
+                    else
+                    {
+                        type.v_table->copy(dest_data + offset, src_data + offset);
+                    }
+                }
             }
         }
 
-        //! book keeping
-        auto last_entity_id = m_buffer2entity_id.at(m_count - 1);
-        m_entities.at(last_entity_id) = comp_i;
-        m_buffer2entity_id.at(comp_i) = last_entity_id;
+        m_count = source.m_count;
+        m_count_last_chunk = source.m_count_last_chunk;
+        m_buffer2entity_id = source.m_buffer2entity_id;
+        auto tick_count = chunk_count * m_type_info.size();
+        m_changed_ticks.assign(source.m_changed_ticks.begin(), source.m_changed_ticks.begin() + tick_count);
+        m_added_ticks.assign(source.m_added_ticks.begin(), source.m_added_ticks.begin() + tick_count);
+        m_chunk_ticks.assign(source.m_chunk_ticks.begin(), source.m_chunk_ticks.begin() + chunk_count);
+    }
 
-        //! pop
-        m_buffer2entity_id.pop_back();
-        m_entities.erase(entity_id);
-        m_count--;
-        m_count_last_chunk--;
-        if (m_count_last_chunk == 0)
+    void Archetype::unshareChunks()
+    {
+        for (std::size_t chunk_i = 0; chunk_i < usedChunkCount(); ++chunk_i)
         {
-            m_count_last_chunk = getBlocksPerChunk(); //! next BYTE_CHUNK will be used next time
+            m_buffer_stable[chunk_i].data(); //! mutable access copies shared chunks
         }
-        return components;
     }
 
-    void Archetype::removeEntity2(int entity_id)
+    std::size_t Archetype::shrink()
     {
-        assert(m_count > 0);
+        while (m_buffer_stable.size() > usedChunkCount())
+        {
+            popChunk();
+        }
+        m_buffer_stable.shrink_to_fit();
+        m_changed_ticks.shrink_to_fit();
+        m_added_ticks.shrink_to_fit();
+        m_chunk_ticks.shrink_to_fit();
 
-        auto comp_i = m_entities.at(entity_id);
-        auto entity_offset = getIndexInArray(comp_i);
+        auto old_capacity = m_buffer2entity_id.capacity();
+        m_buffer2entity_id.shrink_to_fit();
 
-        auto &chunk = m_buffer_stable.at(getArrayIndex(comp_i));
+        return (old_capacity - m_buffer2entity_id.capacity()) * sizeof(EntityId);
+    }
 
-        //! destroy the removed comps
+    std::vector<std::span<std::byte>> Archetype::usedChunkRanges(std::byte *chunk_data, std::size_t block_count) const
+    {
+        std::vector<std::span<std::byte>> ranges;
         for (auto &type : m_type_info)
         {
-            auto comp_p = chunk.data() + entity_offset;
-            type.v_table->dtor(comp_p + m_type2offsets.at(type.id));
+            const auto &column = m_columns[type.id];
+            if (m_layout == ChunkLayout::SoA)
+            {
+                ranges.emplace_back(chunk_data + column.offset, block_count * type.size); //! the column is contiguous
+                continue;
+            }
+            for (std::size_t row = 0; row < block_count; ++row)
+            {
+                ranges.emplace_back(chunk_data + column.offset + row * column.stride, type.size);
+            }
         }
+        return ranges;
+    }
 
-        bool is_last_in_chunk = getIndexInArray(m_count - 1) == getIndexInArray(comp_i);
-        bool is_last_chunk = getArrayIndex(m_count - 1) == getArrayIndex(comp_i);
-        //! if removing last component, we do not swap!
-        if (!(is_last_in_chunk && is_last_chunk))
+    void Archetype::save(std::ostream &os) const
+    {
+        writeRaw<std::uint64_t>(os, getBlocksPerChunk());
+        writeRaw<std::uint64_t>(os, m_count);
+        writeBytes(os, std::as_bytes(std::span(m_buffer2entity_id)));
+
+        std::vector<const ComponentRegistry::Entry *> entries;
+        if (!m_trivially_copyable)
         {
-            assert(getIndexInArray(m_count - 1) == (m_count_last_chunk - 1) * m_total_size);
-            auto &last_chunk = m_buffer_stable.at(getArrayIndex(m_count - 1));
-            auto start_comp_p = chunk.data() + entity_offset;
-            auto last_comp_p = last_chunk.data() + (m_count_last_chunk - 1) * m_total_size;
-            //! move from end to created hole
             for (auto &type : m_type_info)
             {
-                type.v_table->move(start_comp_p + m_type2offsets.at(type.id), last_comp_p + m_type2offsets.at(type.id));
+                entries.push_back(&ComponentRegistry::at(type.id));
             }
         }
 
-        //! book keeping
-        auto last_entity_id = m_buffer2entity_id.at(m_count - 1);
-        m_entities.at(last_entity_id) = comp_i;
-        m_buffer2entity_id.at(comp_i) = last_entity_id;
+        auto chunk_count = usedChunkCount();
+        for (std::size_t chunk_i = 0; chunk_i < chunk_count; ++chunk_i)
+        {
+            auto chunk_data = m_buffer_stable[chunk_i].data();
+            std::size_t block_count = chunk_i + 1 < chunk_count ? getBlocksPerChunk() : m_count_last_chunk;
+            if (m_trivially_copyable)
+            {
+                for (auto range : usedChunkRanges(const_cast<std::byte *>(chunk_data), block_count))
+                {
+                    writeBytes(os, range);
+                }
+                continue;
+            }
+            for (std::size_t row = 0; row < block_count; ++row)
+            {
+                for (std::size_t type_i = 0; type_i < m_type_info.size(); ++type_i)
+                {
+                    const auto &column = m_columns[m_type_info[type_i].id];
+                    entries[type_i]->write(os, chunk_data + column.offset + row * column.stride);
+                }
+            }
+        }
 
-        m_buffer2entity_id.pop_back();
-        m_entities.erase(entity_id);
-        m_count--;
-        m_count_last_chunk--;
-        if (m_count_last_chunk == 0)
+        auto tick_count = chunk_count * m_type_info.size();
+        writeBytes(os, std::as_bytes(std::span(m_changed_ticks.data(), tick_count)));
+        writeBytes(os, std::as_bytes(std::span(m_added_ticks.data(), tick_count)));
+        writeBytes(os, std::as_bytes(std::span(m_chunk_ticks.data(), chunk_count)));
+    }
+
+    void Archetype::load(std::istream &is)
+    {
+        assert(m_count == 0);
+        if (readRaw<std::uint64_t>(is) != getBlocksPerChunk())
+        {
+            throw std::runtime_error("world snapshot was written with a different number of blocks per chunk");
+        }
+        auto ids = readVector<EntityId>(is, readRaw<std::uint64_t>(is));
+        if (ids.empty())
         {
-            m_count_last_chunk = getBlocksPerChunk(); //! next BYTE_CHUNK will be used next time
+            return;
+        }
+
+        //! records are restored as saved, they have to point at the blocks as they get laid out here
+        const auto &entity_table = std::as_const(*m_entity_table);
+        for (std::size_t block_i = 0; block_i < ids.size(); ++block_i)
+        {
+            if (!entity_table.contains(ids[block_i]))
+            {
+                throw std::runtime_error("world snapshot stores components of a removed entity");
+            }
+            auto &record = entity_table.at(ids[block_i]);
+            if (record.archetype != m_index || record.chunk != getArrayIndex(block_i) || record.row != getIndexInArray(block_i))
+            {
+                throw std::runtime_error("world snapshot has an entity record not matching its component block");
+            }
         }
+
+        std::vector<const ComponentRegistry::Entry *> entries;
+        for (auto &type : m_type_info)
+        {
+            entries.push_back(&ComponentRegistry::at(type.id));
+        }
+
+        pushBackBlocks(ids);
+        auto chunk_count = usedChunkCount();
+        for (std::size_t chunk_i = 0; chunk_i < chunk_count; ++chunk_i)
+        {
+            auto chunk_data = m_buffer_stable[chunk_i].data();
+            std::size_t block_count = chunk_i + 1 < chunk_count ? getBlocksPerChunk() : m_count_last_chunk;
+            if (m_trivially_copyable)
+            {
+                for (auto range : usedChunkRanges(chunk_data, block_count))
+                {
+                    readBytes(is, range);
+                }
+                continue;
+            }
+            for (std::size_t row = 0; row < block_count; ++row)
+            {
+                for (std::size_t type_i = 0; type_i < m_type_info.size(); ++type_i)
+                {
+                    const auto &column = m_columns[m_type_info[type_i].id];
+                    try
+                    {
+                        entries[type_i]->read(is, chunk_data + column.offset + row * column.stride);
+                    }
+                    catch (...)
+                    {
+                        //! read constructs before it fails, everything after has to be constructed for the destructor
+                        constructFrom(chunk_i * getBlocksPerChunk() + row, type_i + 1);
+                        throw;
+                    }
+                }
+            }
+        }
+
+        auto tick_count = chunk_count * m_type_info.size();
+        readBytes(is, std::as_writable_bytes(std::span(m_changed_ticks.data(), tick_count)));
+        readBytes(is, std::as_writable_bytes(std::span(m_added_ticks.data(), tick_count)));
+        readBytes(is, std::as_writable_bytes(std::span(m_chunk_ticks.data(), chunk_count)));
     }
 
-    bool Archetype::empty() const
+    bool Archetype::chunkChanged(std::size_t chunk_i, Tick since) const
     {
-        return m_count == 0;
+        if (m_chunk_ticks[chunk_i] >= since)
+        {
+            return true;
+        }
+        auto ticks = std::span(m_changed_ticks).subspan(chunk_i * m_type_info.size(), m_type_info.size());
+        return std::ranges::any_of(ticks, [since](Tick tick)
+                                   { return tick >= since; });
+    }
+
+    std::span<const EntityId> Archetype::chunkEntities(std::size_t chunk_i) const
+    {
+        auto first = chunk_i * getBlocksPerChunk();
+        return std::span(m_buffer2entity_id).subspan(first, std::min(getBlocksPerChunk(), m_count - first));
+    }
+
+    void Archetype::saveChunkColumns(std::ostream &os, std::size_t chunk_i, Tick since) const
+    {
+        //! moved in blocks are new to the reader, so it needs all of their components
+        bool all_columns = m_chunk_ticks[chunk_i] >= since;
+        std::vector<std::size_t> type_indices;
+        for (std::size_t type_i = 0; type_i < m_type_info.size(); ++type_i)
+        {
+            if (all_columns || m_changed_ticks[chunk_i * m_type_info.size() + type_i] >= since)
+            {
+                type_indices.push_back(type_i);
+            }
+        }
+
+        auto chunk_data = m_buffer_stable[chunk_i].data();
+        auto block_count = chunkEntities(chunk_i).size();
+        writeRaw<std::uint32_t>(os, type_indices.size());
+        for (auto type_i : type_indices)
+        {
+            auto &type = m_type_info[type_i];
+            const auto &column = m_columns[type.id];
+            writeRaw(os, type.id);
+            if (!type.trivially_copyable)
+            {
+                auto &entry = ComponentRegistry::at(type.id);
+                for (std::size_t row = 0; row < block_count; ++row)
+                {
+                    entry.write(os, chunk_data + column.offset + row * column.stride);
+                }
+            }
+            else if (m_layout == ChunkLayout::SoA)
+            {
+                writeBytes(os, {chunk_data + column.offset, block_count * type.size}); //! the column is contiguous
+            }
+            else
+            {
+                for (std::size_t row = 0; row < block_count; ++row)
+                {
+                    writeBytes(os, {chunk_data + column.offset + row * column.stride, type.size});
+                }
+            }
+        }
+    }
+
+    void Archetype::constructFrom(std::size_t comp_i, std::size_t type_i)
+    {
+        for (; comp_i < m_count; ++comp_i, type_i = 0)
+        {
+            for (; type_i < m_type_info.size(); ++type_i)
+            {
+                if (!m_type_info[type_i].trivially_destructible)
+                {
+                    ComponentRegistry::at(m_type_info[type_i].id).construct(getComponentData(comp_i, m_type_info[type_i].id));
+                }
+            }
+        }
+    }
+
+    void Archetype::loadChunkColumns(std::istream &is, std::span<const std::size_t> comp_indices, const std::vector<bool> &fresh)
+    {
+        assert(comp_indices.size() == fresh.size());
+        std::vector<const ComponentRegistry::Entry *> entries(m_type_info.size(), nullptr);
+        for (std::size_t type_i = 0; type_i < m_type_info.size(); ++type_i)
+        {
+            if (!m_type_info[type_i].trivially_copyable)
+            {
+                entries[type_i] = &ComponentRegistry::at(m_type_info[type_i].id);
+            }
+        }
+
+        std::vector<bool> type_read(m_type_info.size(), false);
+        std::size_t current_type = m_type_info.size(); //! column being read
+        std::size_t current_i = 0;                      //! block being read
+        try
+        {
+            auto column_count = readRaw<std::uint32_t>(is);
+            if (column_count != m_type_info.size() && std::ranges::find(fresh, true) != fresh.end())
+            {
+                throw std::runtime_error("delta misses components of an entity new to the world");
+            }
+
+            for (std::uint32_t column_i = 0; column_i < column_count; ++column_i)
+            {
+                auto type_id = readRaw<int>(is);
+                if (!hasComponent(type_id) || getColumn(type_id).offset >= SHARED_COLUMN)
+                {
+                    throw std::runtime_error("delta holds a component the archetype does not store");
+                }
+                current_type = getColumn(type_id).type_index;
+                auto &type = m_type_info[current_type];
+                for (current_i = 0; current_i < comp_indices.size(); ++current_i)
+                {
+                    auto comp_p = getComponentData(comp_indices[current_i], type_id);
+                    if (entries[current_type])
+                    {
+                        if (!fresh[current_i] && !type.trivially_destructible)
+                        {
+                            type.v_table->dtor(comp_p);
+                        }
+                        entries[current_type]->read(is, comp_p);
+                    }
+                    else
+                    {
+                        readBytes(is, {comp_p, type.size});
+                    }
+                    markChanged(comp_indices[current_i], type_id);
+                }
+                type_read[current_type] = true;
+                current_type = m_type_info.size();
+            }
+        }
+        catch (...)
+        {
+            //! fresh blocks have to hold constructed components for the destructor, read constructs before it fails
+            for (std::size_t type_i = 0; type_i < m_type_info.size(); ++type_i)
+            {
+                if (m_type_info[type_i].trivially_destructible || type_read[type_i])
+                {
+                    continue;
+                }
+                for (std::size_t i = type_i == current_type ? current_i + 1 : 0; i < comp_indices.size(); ++i)
+                {
+                    if (fresh[i])
+                    {
+                        entries[type_i]->construct(getComponentData(comp_indices[i], m_type_info[type_i].id));
+                    }
+                }
+            }
+            throw;
+        }
     }
 
     std::size_t Archetype::chunkCount() const
@@ -192,26 +843,38 @@ namespace ecs
         return m_buffer_stable.size();
     }
 
+    std::size_t Archetype::entityCount() const
+    {
+        return m_count;
+    }
+
+    std::size_t Archetype::usedChunkCount() const
+    {
+        return m_count > 0 ? getArrayIndex(m_count - 1) + 1 : 0;
+    }
+
+    ChunkLayout Archetype::layout() const
+    {
+        return m_layout;
+    }
+
     std::size_t Archetype::getBlocksPerChunk() const
     {
-        return COMPONENT_CHUNK_SIZE / m_total_size;
+        return m_blocks_per_chunk;
     }
 
     std::size_t Archetype::getArrayIndex(std::size_t comp_index) const
     {
-        //! end of component block must be inside CHUNK_SIZE
-        int blocks_per_chunk = getBlocksPerChunk();
-        return (comp_index) / blocks_per_chunk;
+        return comp_index / getBlocksPerChunk();
     }
     std::size_t Archetype::getIndexInArray(std::size_t comp_index) const
     {
-        int blocks_per_chunk = getBlocksPerChunk();
-        return ((comp_index) % blocks_per_chunk) * m_total_size;
+        return comp_index % getBlocksPerChunk();
     }
     bool Archetype::needsAnotherChunk() const
     {
-        //! if next inserted component block is beyond CHUNK_SIZE we need another chunk
-        return (m_count_last_chunk + 1) * m_total_size > COMPONENT_CHUNK_SIZE;
+        //! if next inserted component block is beyond the last chunk we need another one
+        return getArrayIndex(m_count) >= m_buffer_stable.size();
     }
 
-} // namespace ecs
\ No newline at end of file
+} // namespace ecs
@@ -8,25 +8,67 @@
 #include <unordered_map>
 #include <concepts>
 #include <algorithm>
+#include <array>
+#include <tuple>
+#include <memory>
+#include <span>
+#include <cstring>
+#include <utility>
+#include <cstdint>
+#include <istream>
+#include <ostream>
 
 #include "Component.h"
+#include "ArchetypeId.h"
+#include "ChunkPool.h"
 
 namespace ecs
 {
 
+	class EntityTable;
+
 #ifndef MEMORY_CHUNK_SIZE
 #define MEMORY_CHUNK_SIZE 100000
 #endif
 
 	constexpr int COMPONENT_CHUNK_SIZE = MEMORY_CHUNK_SIZE;
 
+	//! columns of SoA chunks start at multiples of this (one cache line)
+	constexpr std::size_t COLUMN_ALIGNMENT = 64;
+
+	//! how component blocks are stored inside a chunk
+	enum class ChunkLayout
+	{
+		AoS, //!< components of one entity are packed together into a block of m_total_size bytes
+		SoA	 //!< each component type has its own contiguous column in the chunk
+	};
+
 	using EntityId = std::size_t;
+	//! dense index of an archetype in its world
+	using ArchetypeIndex = std::uint32_t;
+	constexpr ArchetypeIndex NO_ARCHETYPE = static_cast<ArchetypeIndex>(-1);
+	//! world time used for change detection, chunks remember the tick of the last write into each of their columns
+	using Tick = std::uint64_t;
+
+	static_assert(FIRST_DYNAMIC_COMPONENT_ID < MAX_COMPONENT_COUNT, "no ids left for registered components");
+
+	//! \returns id of the archetype made of Comps..., a constant expression if all of them have static ids
+	template <Component... Comps>
+	constexpr ArchetypeId archetypeIdOf()
+	{
+		ArchetypeId id;
+		(id.set(Comps::id), ...);
+		return id;
+	}
+
 
 	struct CompTypeInfo
 	{
 		int id;
 		std::size_t size;
 		unsigned long align;
+		bool trivially_copyable;	//! can be moved and copied by memcpy
+		bool trivially_destructible; //! destructor does not need to be called
 
 		template <class Comp>
 		static void destroy_s(void *obj)
@@ -65,12 +107,15 @@ namespace ecs
 		const VTable *v_table = nullptr;
 		template <class Comp>
 		CompTypeInfo(Comp c) : id(Comp::id), size(sizeof(Comp)), align(alignof(Comp)),
-								   v_table(&v_table_temp<Comp>)
+							   trivially_copyable(std::is_trivially_copyable_v<Comp>),
+							   trivially_destructible(std::is_trivially_destructible_v<Comp>),
+							   v_table(&v_table_temp<Comp>)
 		{
 		}
 
 		CompTypeInfo(const CompTypeInfo& from)
-			: id(from.id), size(from.size), align(from.align)
+			: id(from.id), size(from.size), align(from.align),
+			  trivially_copyable(from.trivially_copyable), trivially_destructible(from.trivially_destructible)
 		{
 			v_table = from.v_table;
 		}
@@ -87,41 +132,483 @@ namespace ecs
 	};
 
 
+	//! stride aware view of one component type inside a chunk, i-th component lives at data + i * stride
+	template <class Comp>
+	class ColumnView
+	{
+	public:
+		ColumnView(std::byte *data, std::size_t stride, std::size_t size)
+			: m_data(data), m_stride(stride), m_size(size) {}
+
+		Comp &operator[](std::size_t i) const
+		{
+			assert(i < m_size);
+			return *std::launder(reinterpret_cast<Comp *>(m_data + i * m_stride));
+		}
+
+		std::size_t size() const { return m_size; }
+		std::size_t stride() const { return m_stride; }
+
+		//! true when the components form a plain array (SoA chunks)
+		bool contiguous() const { return m_stride == sizeof(Comp); }
+
+		//! pointer to the first component, can be indexed as an array only if contiguous()
+		Comp *data() const { return std::launder(reinterpret_cast<Comp *>(m_data)); }
+
+	private:
+		std::byte *m_data;
+		std::size_t m_stride;
+		std::size_t m_size;
+	};
+
+	//! offset of an Optional component missing in the archetype
+	constexpr std::size_t MISSING_COLUMN = static_cast<std::size_t>(-1);
+	//! offset of a tag component, tags have no storage
+	constexpr std::size_t TAG_COLUMN = MISSING_COLUMN - 1;
+	//! offset of a shared component, its value is stored once for the whole archetype
+	constexpr std::size_t SHARED_COLUMN = MISSING_COLUMN - 2;
+
+	//! stands in for every component of the tag type Comp, there is nothing in which tags could differ
+	template <TagComponent Comp>
+	std::remove_cv_t<Comp> &tagInstance()
+	{
+		static std::remove_cv_t<Comp> instance;
+		return instance;
+	}
+
+	//! \returns false if two of Comps... claim the same static id, their columns would alias
+	template <Component... Comps>
+	constexpr bool distinctStaticIds()
+	{
+		auto static_id = []<Component Comp>(std::type_identity<Comp>)
+		{
+			if constexpr (Comp::static_id)
+			{
+				return Comp::id;
+			}
+			else
+			{
+				return DYNAMIC_COMPONENT_ID;
+			}
+		};
+		std::array<int, sizeof...(Comps)> ids{static_id(std::type_identity<Comps>{})...};
+		for (std::size_t i = 0; i < ids.size(); ++i)
+		{
+			for (std::size_t j = i + 1; j < ids.size(); ++j)
+			{
+				if (ids[i] != DYNAMIC_COMPONENT_ID && ids[i] == ids[j])
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	//! offsets of Comps... inside AoS blocks of the archetype made of exactly Comps... (TAG_COLUMN for tags)
+	//! follows the ordering of Archetype::registerComps, so it is a constant expression when all Comps... have static ids
+	template <Component... Comps>
+	constexpr std::array<std::size_t, sizeof...(Comps)> staticBlockOffsets()
+	{
+		struct Info
+		{
+			int id;
+			std::size_t size;
+			std::size_t align;
+		};
+		//! tags take no space, so they do not shift the others wherever they get sorted
+		std::array<Info, sizeof...(Comps)> sorted{Info{Comps::id, TagComponent<Comps> ? 0 : sizeof(Comps), alignof(Comps)}...};
+		std::sort(sorted.begin(), sorted.end(), [](const Info &a, const Info &b)
+				  { return std::tie(a.align, a.id) > std::tie(b.align, b.id); });
+
+		std::array<int, sizeof...(Comps)> ids{Comps::id...};
+		std::array<std::size_t, sizeof...(Comps)> offsets{};
+		std::size_t offset = 0;
+		for (auto &info : sorted)
+		{
+			for (std::size_t i = 0; i < ids.size(); ++i)
+			{
+				if (ids[i] == info.id)
+				{
+					offsets[i] = offset;
+				}
+			}
+			offset += info.size;
+		}
+		std::array<bool, sizeof...(Comps)> tags{TagComponent<Comps>...};
+		for (std::size_t i = 0; i < tags.size(); ++i)
+		{
+			if (tags[i])
+			{
+				offsets[i] = TAG_COLUMN;
+			}
+		}
+		return offsets;
+	}
+
+	//! offsets known at compile time, indexing them folds into immediates
+	template <auto Offsets>
+	struct ConstantOffsets
+	{
+		constexpr std::size_t operator[](std::size_t i) const
+		{
+			return Offsets[i];
+		}
+	};
+
+	//! query term for a component which need not be present, actions get it as a pointer which is nullptr when missing
+	template <Component Comp>
+	struct Optional
+	{
+	};
+
+	//! how a query term is handed to actions, components go by reference
+	template <class Term>
+	struct TermAccess
+	{
+		using Type = Term;
+		static constexpr bool optional = false;
+
+		//! \returns start of the column in a SoA chunk
+		static Term *column(std::byte *chunk_data, std::size_t offset)
+		{
+			return std::launder(reinterpret_cast<Term *>(chunk_data + offset));
+		}
+		static Term &fromColumn(Term *column, std::size_t i)
+		{
+			return column[i];
+		}
+		static Term &fromBlock(std::byte *block, std::size_t offset)
+		{
+			return *std::launder(reinterpret_cast<Term *>(block + offset));
+		}
+	};
+
+	//! Optional components go by pointer, whether they are present is resolved per archetype by their offset
+	template <Component Comp>
+	struct TermAccess<Optional<Comp>>
+	{
+		using Type = Comp;
+		static constexpr bool optional = true;
+
+		static Comp *column(std::byte *chunk_data, std::size_t offset)
+		{
+			return offset == MISSING_COLUMN ? nullptr : std::launder(reinterpret_cast<Comp *>(chunk_data + offset));
+		}
+		static Comp *fromColumn(Comp *column, std::size_t i)
+		{
+			return column ? column + i : nullptr;
+		}
+		static Comp *fromBlock(std::byte *block, std::size_t offset)
+		{
+			return offset == MISSING_COLUMN ? nullptr : std::launder(reinterpret_cast<Comp *>(block + offset));
+		}
+	};
+
+	//! tags go by reference to their shared instance, nothing is stored in the chunks
+	template <TagComponent Comp>
+	struct TermAccess<Comp>
+	{
+		using Type = Comp;
+		static constexpr bool optional = false;
+
+		static Comp *column(std::byte *, std::size_t)
+		{
+			return &tagInstance<Comp>();
+		}
+		static Comp &fromColumn(Comp *column, std::size_t)
+		{
+			return *column;
+		}
+		static Comp &fromBlock(std::byte *, std::size_t)
+		{
+			return tagInstance<Comp>();
+		}
+	};
+
+	template <TagComponent Comp>
+	struct TermAccess<Optional<Comp>>
+	{
+		using Type = Comp;
+		static constexpr bool optional = true;
+
+		static Comp *column(std::byte *, std::size_t offset)
+		{
+			return offset == MISSING_COLUMN ? nullptr : &tagInstance<Comp>();
+		}
+		static Comp *fromColumn(Comp *column, std::size_t)
+		{
+			return column;
+		}
+		static Comp *fromBlock(std::byte *, std::size_t offset)
+		{
+			return offset == MISSING_COLUMN ? nullptr : &tagInstance<Comp>();
+		}
+	};
+
+	//! component (possibly const) or Optional component
+	template <class Term>
+	concept QueryTerm = Component<typename TermAccess<Term>::Type>;
+
+	//! parameter of per entity init callables: stored components are mutable, tags and shared components are the
+	//! same for all entities and const
+	template <Component Comp>
+	using InitParam = std::conditional_t<TagComponent<Comp> || SharedComponent<Comp>, const Comp &, Comp &>;
+
 	struct Archetype
 	{
+		//! component of the i-th block in a chunk lives at: chunk.data() + offset + i * stride
+		struct Column
+		{
+			std::size_t offset = 0;
+			std::size_t stride = 0;
+			std::size_t type_index = 0; //! index of the component type in m_type_info
+		};
+
+		//! cached transition into the archetype with one component added or removed
+		struct Edge
+		{
+			//! component present in both archetypes
+			struct Transfer
+			{
+				const CompTypeInfo::VTable *v_table;
+				Column src_column;
+				Column dst_column;
+				std::size_t size;
+				bool trivially_copyable; //! moved by memcpy
+			};
+			//! component present only in the source archetype and needing its destructor called
+			struct Drop
+			{
+				const CompTypeInfo::VTable *v_table;
+				Column src_column;
+			};
+
+			Archetype *target = nullptr;
+			ArchetypeIndex target_index = NO_ARCHETYPE;
+			std::vector<Transfer> transfers = {};
+			std::vector<Drop> drops = {};
+			Column changed_column = {}; //! column of the added component in target or of the removed one in source
+		};
+
+		//! type erased value of a shared component
+		struct SharedValue
+		{
+			int id;
+			std::shared_ptr<const void> value;
+			bool (*equal)(const void *first, const void *second);
+			std::size_t hash; //!< hash of the value, archetypes are looked up by it
+
+			template <SharedComponent Comp>
+			static SharedValue of(const Comp &comp)
+			{
+				using Value = std::remove_cv_t<Comp>;
+				std::size_t hash;
+				if constexpr (requires(const Value &value) { std::hash<Value>{}(value); })
+				{
+					hash = std::hash<Value>{}(comp);
+				}
+				else
+				{
+					static_assert(requires(const Value &value) { { value.hash() } -> std::convertible_to<std::size_t>; },
+								  "shared components need std::hash or a std::size_t hash() const member");
+					hash = comp.hash();
+				}
+				return {.id = Comp::id,
+						.value = std::make_shared<const Value>(comp),
+						.equal = [](const void *first, const void *second)
+						{ return *static_cast<const Value *>(first) == *static_cast<const Value *>(second); },
+						.hash = hash};
+			}
+
+			bool operator==(const SharedValue &other) const
+			{
+				return id == other.id && equal(value.get(), other.value.get());
+			}
+		};
+
+		Archetype() = default;
 		~Archetype();
 
-		void registerComps(std::vector<CompTypeInfo> type_info);
+		//! sets the pool from which chunks are taken, must be called before the first entity is added
+		void setChunkPool(ChunkPool &pool);
+		//! writes get stamped by the value of tick, which has to outlive the archetype
+		void setWorldTick(const Tick &tick);
+		//! locations of the stored entities are kept up to date in their records in table, self is index of this archetype
+		void setEntityTable(EntityTable &table, ArchetypeIndex self);
 
+		//! type_info must not contain tags, they get registered by registerTags
+		void registerComps(std::vector<CompTypeInfo> type_info, ChunkLayout layout = ChunkLayout::AoS);
+
+		//! tags among Comps... are skipped, see registerTags
 		template <Component... Comps>
-		void registerComps();
+		void registerComps(ChunkLayout layout = ChunkLayout::AoS);
+
+		//! components of signature without registered type info are tags, they get a column with offset TAG_COLUMN
+		//! which has no storage, so tags cost nothing per block and are never touched when blocks move
+		void registerTags(const ArchetypeId &signature);
+
+		//! sets values of the shared components (sorted by id), must be called before registerTags
+		//! archetypes with the same components but different shared values are separate, so that every chunk
+		//! holds a single value of each shared component
+		void setSharedValues(std::vector<SharedValue> values);
+		const std::vector<SharedValue> &sharedValues() const;
+
+		//! \returns value of Comp shared by all entities of this archetype
+		template <SharedComponent Comp>
+		const Comp &getShared() const;
 
 		template <Component Comp>
 		Comp &get2(std::size_t entity_id);
 
-		template <class Callable, Component... Comps>
+		//! \returns component of the block at row of chunk chunk_i (as stored in the entity record)
+		//! shared components can only be read, they change by moving the entity into another archetype
+		template <Component Comp>
+		Comp &getAt(std::size_t chunk_i, std::size_t row);
+
+		//! Comps... may contain Optional terms, the action gets nullptr for those missing in this archetype
+		template <class Callable, QueryTerm... Comps>
 		void forEach2(Callable action);
 
-		std::byte *allocateNewEntity(std::size_t entity_id);
+		//! same as above but with offsets of Comps... already looked up by getOffsets
+		template <class Callable, QueryTerm... Comps>
+		void forEach2(Callable action, const std::array<std::size_t, sizeof...(Comps)> &offsets);
+
+		//! calls action on component blocks in chunks [chunk_begin, chunk_end), chunks never share blocks so
+		//! disjoint chunk ranges can be processed concurrently
+		template <class Callable, QueryTerm... Comps>
+		void forEach2(Callable action, const std::array<std::size_t, sizeof...(Comps)> &offsets,
+					  std::size_t chunk_begin, std::size_t chunk_end);
+
+		//! same as forEach2 for an AoS archetype made of exactly Comps... with static ids (see staticBlockOffsets)
+		//! the offsets are template arguments, so the compiler can fold them into the address computations
+		template <class Callable, Component... Comps>
+		void forEachStatic(Callable action);
+
+		//! calls action(ids, ColumnView<Comps>...) once for each chunk in [chunk_begin, chunk_end)
+		//! ids are the entity ids of the component blocks in the chunk, shared components go as const Comp& instead of a view
+		template <class Callable, Component... Comps>
+		void forEachChunk(Callable action, const std::array<std::size_t, sizeof...(Comps)> &offsets,
+						  std::size_t chunk_begin, std::size_t chunk_end);
+
+		//! \returns offsets of Comps... inside component blocks (AoS) or chunks (SoA)
+		//! missing Optional components get MISSING_COLUMN
+		template <QueryTerm... Comps>
+		std::array<std::size_t, sizeof...(Comps)> getOffsets() const;
+
+		//! reserves a component block for entity_id without constructing anything in it
+		//! \returns index of the reserved component block
+		std::size_t allocateNewEntity(std::size_t entity_id);
+
+		//! \returns address of the component type_id in component block comp_index
+		std::byte *getComponentData(std::size_t comp_index, int type_id);
+		std::byte *getComponentData(std::size_t comp_index, const Column &column);
+		//! read only access, does not copy a chunk shared with a fork
+		const std::byte *getComponentData(std::size_t comp_index, const Column &column) const;
+
+		const Column &getColumn(int type_id) const;
+
+		bool hasComponent(int type_id) const;
+
+		//! \returns tick of the last write into column type_id of chunk chunk_i
+		//! structural changes (blocks moved in or out of the chunk) count as writes of all columns
+		Tick changedTick(std::size_t chunk_i, int type_id) const;
+		//! \returns tick of the last construction of a new type_id component in chunk chunk_i
+		//! (components moved in from other archetypes do not count)
+		Tick addedTick(std::size_t chunk_i, int type_id) const;
+
+		//! stamps column type_id of the chunk holding block comp_index by the current tick
+		void markChanged(std::size_t comp_index, int type_id);
+		//! same as markChanged but for a newly constructed component, so it stamps the added tick too
+		void markAdded(std::size_t comp_index, int type_id);
+
+		//! \returns true if blocks were moved into chunk chunk_i or any of its columns got written since the tick since
+		bool chunkChanged(std::size_t chunk_i, Tick since) const;
+		//! \returns ids of the entities in chunk chunk_i, in the order of their blocks
+		std::span<const EntityId> chunkEntities(std::size_t chunk_i) const;
+		//! writes the columns of chunk chunk_i written since the tick since (all of them if blocks were moved in)
+		//! \throws std::runtime_error if a non trivially copyable component is not in the ComponentRegistry
+		void saveChunkColumns(std::ostream &os, std::size_t chunk_i, Tick since) const;
+		//! reads columns written by saveChunkColumns into blocks comp_indices, one per entity of the saved chunk
+		//! blocks with fresh set are unconstructed and have to receive all columns, components of the others get replaced
+		//! \throws std::runtime_error on truncated input, unknown components or a fresh block left without components
+		void loadChunkColumns(std::istream &is, std::span<const std::size_t> comp_indices, const std::vector<bool> &fresh);
+
+		//! creates edge from this archetype into target, transfers contain all components of this present in target
+		//! and drops the rest
+		Edge makeEdge(Archetype &target, ArchetypeIndex target_index) const;
+
+		//! moves transferred components of entity_id straight into a new block of edge.target (each of them exactly once),
+		//! destroys the dropped ones and fills the created hole by the last block
+		//! components of edge.target not present here are left unconstructed
+		//! \returns index of the new block in edge.target
+		std::size_t moveEntity(std::size_t entity_id, const Edge &edge);
+		//! same as moveEntity for all ids at once, blocks in edge.target are reserved up front
+		//! \returns index of the new block of ids[0] in edge.target, the others follow in order
+		std::size_t moveEntities(std::span<const EntityId> ids, const Edge &edge);
+
+		//! \returns index of the component block of entity_id
+		std::size_t getBlockIndex(std::size_t entity_id) const;
+
 		void addEntity2(std::size_t entity_id, std::vector<std::byte> data);
 
 		//! adds components of the entity entity_id at the end of the m_buffer by copy constructing them
 		template <Component... Comps>
 		void addEntity2(std::size_t entity_id, Comps&&... data);
 
-		std::vector<std::byte> removeEntityAndGetData(int entity_id);
+		//! adds entities ids at the end of m_buffer, their components are copy constructed from prototypes column by column
+		template <Component... Comps>
+		void addEntities(std::span<const EntityId> ids, const Comps &...prototypes);
+
+		//! like addEntities above, afterwards init(i, comps...) gets called chunk by chunk with the components of ids[i]
+		template <Component... Comps, typename Init>
+			requires std::invocable<Init &, std::size_t, InitParam<Comps>...>
+		void addEntities(std::span<const EntityId> ids, Init &init, const Comps &...prototypes);
 
-		void removeEntity2(int entity_id);
+		std::vector<std::byte> removeEntityAndGetData(std::size_t entity_id);
+
+		void removeEntity2(std::size_t entity_id);
 
 		bool empty() const;
 
+		//! writes entity ids, component blocks and ticks of the used chunks
+		//! trivially copyable archetypes go chunk by chunk as raw bytes, others component by component
+		//! \throws std::runtime_error if a non trivially copyable component is not in the ComponentRegistry
+		void save(std::ostream &os) const;
+		//! reads what save wrote into this empty archetype registered with the same components in the same order
+		//! records of the entities have to be loaded already, they are not touched
+		//! \throws std::runtime_error on truncated input, if a component is not in the ComponentRegistry, if chunks
+		//! hold a different number of blocks than in the saving process or if the records do not match the blocks
+		void load(std::istream &is);
+
+		//! fills this empty archetype, registered with the same components and layout as source, by the blocks of source
+		//! chunks of trivially copyable archetypes get shared copy-on-write, others are copied component by component
+		//! records of the entities have to be copied already, they are not touched
+		void forkFrom(const Archetype &source);
+		//! copies the chunks still shared with forked archetypes, later writes into them then do not replace their memory
+		void unshareChunks();
+
+		//! releases all unused chunks to the pool and shrinks the bookkeeping to the number of stored entities
+		//! \returns number of bookkeeping bytes freed (chunks stay in the pool)
+		std::size_t shrink();
+
 		std::size_t chunkCount() const;
+		//! \returns number of stored entities
+		std::size_t entityCount() const;
+		//! \returns number of chunks holding at least one component block
+		std::size_t usedChunkCount() const;
+
+		ChunkLayout layout() const;
 
 		//! saved components info
 		std::size_t m_total_size = 0; //! size in bytes of a single component block
 		std::size_t m_padding = 0;	  //! size in bytes of padding at the end of a component block
 		std::vector<CompTypeInfo> m_type_info;
-		std::unordered_map<int, std::size_t> m_type2offsets;
+		std::vector<std::size_t> m_type2offsets; //! offsets of components of m_type_info inside a packed component block
+
+		std::unordered_map<int, Edge> m_add_edges;	  //! transitions after adding component with the given id
+		std::unordered_map<int, Edge> m_remove_edges; //! transitions after removing component with the given id
+		std::unordered_map<ArchetypeIndex, Edge> m_shared_edges; //! transitions into archetypes with other shared values
 
 	private:
 		std::size_t getBlocksPerChunk() const;
@@ -129,110 +616,364 @@ namespace ecs
 		std::size_t getIndexInArray(std::size_t comp_index) const;
 		bool needsAnotherChunk() const;
 
+		//! appends an uninitialized component block at the end and does the bookkeeping
+		std::size_t pushBackBlock(std::size_t entity_id);
+		//! moves components from block src_i into unconstructed block dest_i, memcpy is used where possible
+		void moveBlock(std::size_t dest_i, std::size_t src_i);
+		//! moves/destroys components of block comp_i into the constructed block new_comp_i of edge.target
+		void transferBlock(std::size_t comp_i, std::size_t new_comp_i, const Edge &edge);
+		//! calls destructors of the components in block comp_i that need it
+		void destroyBlock(std::size_t comp_i);
+
+		//! appends ids.size() uninitialized component blocks at once, locations of ids are not written (see setLocation)
+		//! \returns index of the first one
+		std::size_t pushBackBlocks(std::span<const EntityId> ids);
+		//! writes location of block comp_i into the record of its entity
+		void setLocation(std::size_t comp_i);
+		//! default constructs the non trivially destructible components of all blocks from type_i of block comp_i on,
+		//! so that an archetype left half loaded by a failed read can be destroyed (components have to be registered)
+		void constructFrom(std::size_t comp_i, std::size_t type_i);
+		//! fills the (already destroyed) component block comp_index by the last one and pops the end
+		//! trailing empty chunks are released except one kept as spare
+		void eraseBlock(std::size_t comp_index);
 
+
+		//! owns one uninitialized chunk taken from the pool, possibly together with chunks of forked archetypes
+		//! a shared chunk gets copied on the first mutable access, so only trivially copyable blocks may be shared
 		struct ByteChunk
 		{
-			alignas(std::max_align_t) std::vector<std::byte> buffer;
+			explicit ByteChunk(ChunkPool &pool) : m_pool(&pool), m_data(pool.allocate(), Release{&pool}) {}
+			ByteChunk(ByteChunk &&other) noexcept = default;
+			ByteChunk &operator=(ByteChunk &&other) noexcept = default;
 
-			ByteChunk() : buffer(COMPONENT_CHUNK_SIZE) {}
+			//! \returns chunk sharing the memory with this one, the pool has to outlive both
+			ByteChunk share() const
+			{
+				return ByteChunk(*this);
+			}
 
 			std::byte *data()
 			{
-				return buffer.data();
+				if (m_data.use_count() > 1) //! somebody else still reads it
+				{
+					ByteChunk copy(*m_pool);
+					std::memcpy(copy.m_data.get(), m_data.get(), m_pool->chunkSize());
+					*this = std::move(copy);
+				}
+				return m_data.get();
+			}
+			const std::byte *data() const
+			{
+				return m_data.get();
 			}
-		};
 
-		struct Column
-		{
-			Column()
+		private:
+			ByteChunk(const ByteChunk &other) = default;
+
+			struct Release
 			{
-				
+				ChunkPool *pool;
+				void operator()(std::byte *data) const
+				{
+					pool->release(data);
+				}
 			};
 
-			std::size_t entity_offset;
-			ByteChunk* p_chunk = nullptr;
+			ChunkPool *m_pool;
+			std::shared_ptr<std::byte> m_data;
 		};
 
+		//! appends a new chunk taken from m_chunk_pool
+		void addChunk();
+		//! releases the last chunk back to m_chunk_pool
+		void popChunk();
+
+		Tick currentTick() const;
+		//! \returns index of column type_id of chunk chunk_i in m_changed_ticks and m_added_ticks
+		std::size_t tickIndex(std::size_t chunk_i, int type_id) const;
+		//! stamps all columns of chunks holding blocks [comp_begin, comp_end) as changed (and added)
+		void markBlocks(std::size_t comp_begin, std::size_t comp_end, bool added);
+		//! \returns byte ranges of the components of the first block_count blocks of the chunk at chunk_data,
+		//! padding and unused parts of columns are left out
+		std::vector<std::span<std::byte>> usedChunkRanges(std::byte *chunk_data, std::size_t block_count) const;
+		//! stamps columns of the mutably accessed Comps... in chunk chunk_i as changed
+		template <QueryTerm... Comps>
+		void markWritten(std::size_t chunk_i);
+		//! \returns data of chunk chunk_i for accessing Comps... and stamps the mutably accessed ones by markWritten
+		//! read only access leaves a chunk shared with forked archetypes alone
+		template <QueryTerm... Comps>
+		std::byte *accessChunk(std::size_t chunk_i);
+
+		ChunkLayout m_layout = ChunkLayout::AoS;
+		bool m_trivially_copyable = true;	  //! all components can be moved by memcpy
+		bool m_trivially_destructible = true; //! no component needs its destructor called
+		std::size_t m_blocks_per_chunk = 0;
+		std::vector<Column> m_columns; //! column of each component indexed by its id, missing ones have offset MISSING_COLUMN
+		std::vector<SharedValue> m_shared_values; //! values of the shared components sorted by id
 
 		std::size_t m_count = 0;				   //! total number of stored entities (i.e. component blocks)
-		std::size_t m_count_last_chunk = 0;		   //! total number of stored entities (i.e. component blocks)
-		std::vector<ByteChunk> m_buffer_stable{1}; //! buffer for all component blocks (starts with one chunk)
+		std::size_t m_count_last_chunk = 0;		   //! number of component blocks in the last used chunk
+		ChunkPool *m_chunk_pool = nullptr;
+		std::vector<ByteChunk> m_buffer_stable; //! buffer for all component blocks
 
-		std::vector<EntityId> m_buffer2entity_id;			  //! entity ids of each component block
-		std::unordered_map<EntityId, std::size_t> m_entities; //! component block id of each entity
+		const Tick *m_world_tick = nullptr;
+		std::vector<Tick> m_changed_ticks; //! last write into each column of each chunk, see tickIndex
+		std::vector<Tick> m_added_ticks;   //! last construction of a component in each column of each chunk
+		std::vector<Tick> m_chunk_ticks;   //! last time blocks were moved into each chunk (also covers chunks without columns)
+
+		std::vector<EntityId> m_buffer2entity_id; //! entity ids of each component block
+		EntityTable *m_entity_table = nullptr;	  //! records of the entities with their locations
+		ArchetypeIndex m_index = NO_ARCHETYPE;	  //! index of this archetype in the records
 	};
 
 	template <Component... Comps>
-	void Archetype::registerComps()
+	void Archetype::registerComps(ChunkLayout layout)
 	{
-		// m_type_info.resize(sizeof...(Comps));
-
-		int i = 0;
-		((m_type_info.emplace_back(Comps{}), i++), ...);
+		static_assert(distinctStaticIds<Comps...>(), "two components of the archetype have the same static id");
+		std::vector<CompTypeInfo> type_info;
+		auto add_info = [&]<Component Comp>(std::type_identity<Comp>)
+		{
+			if constexpr (!TagComponent<Comp> && !SharedComponent<Comp>)
+			{
+				type_info.emplace_back(Comp{});
+			}
+		};
+		(add_info(std::type_identity<Comps>{}), ...);
 
 		//! largest alignements go first in component blocks -> if the first is aligned then so are the others
-		std::sort(m_type_info.begin(), m_type_info.end());
+		std::sort(type_info.begin(), type_info.end());
+		registerComps(std::move(type_info), layout);
+	}
 
-		std::size_t offset = 0;
-		for (auto &[id, size, align, v_table] : m_type_info)
-		{
-			m_type2offsets[id] = offset;
-			offset += size;
-		}
-		auto max_align = m_type_info[0].align;
-		m_padding = (max_align - (offset % max_align)) % max_align;
+	template <SharedComponent Comp>
+	const Comp &Archetype::getShared() const
+	{
+		auto value_it = std::find_if(m_shared_values.begin(), m_shared_values.end(), [](const SharedValue &value)
+									 { return value.id == Comp::id; });
+		assert(value_it != m_shared_values.end());
+		return *static_cast<const Comp *>(value_it->value.get());
+	}
 
-		m_total_size = (sizeof(Comps) + ... + (0));
-		m_total_size += m_padding;
+	//! \returns values of the shared components among comps sorted by id
+	template <Component... Comps>
+	std::vector<Archetype::SharedValue> sharedValuesOf(const Comps &...comps)
+	{
+		std::vector<Archetype::SharedValue> values;
+		auto add = [&]<Component Comp>(const Comp &comp)
+		{
+			if constexpr (SharedComponent<Comp>)
+			{
+				values.push_back(Archetype::SharedValue::of(comp));
+			}
+		};
+		(add(comps), ...);
+		std::sort(values.begin(), values.end(), [](const auto &first, const auto &second)
+				  { return first.id < second.id; });
+		return values;
 	}
 
 	template <Component Comp>
 	Comp &Archetype::get2(std::size_t entity_id)
 	{
-		auto comp_i = m_entities.at(entity_id);
-		auto comp_offset = m_type2offsets.at(Comp::id);
-		auto entity_offset = getIndexInArray(comp_i);
+		auto comp_i = getBlockIndex(entity_id);
+		return getAt<Comp>(getArrayIndex(comp_i), getIndexInArray(comp_i));
+	}
 
-		auto &chunk = m_buffer_stable.at(getArrayIndex(comp_i));
-		return *std::launder(reinterpret_cast<Comp *>(chunk.data() + entity_offset + comp_offset));
+	template <Component Comp>
+	Comp &Archetype::getAt(std::size_t chunk_i, std::size_t row)
+	{
+		assert(hasComponent(Comp::id) && chunk_i < usedChunkCount());
+		if constexpr (SharedComponent<Comp>)
+		{
+			static_assert(std::is_const_v<Comp>, "shared components change by addComponent, which moves the entity");
+			return getShared<Comp>();
+		}
+		else if constexpr (TagComponent<Comp>)
+		{
+			return tagInstance<Comp>();
+		}
+		else
+		{
+			const auto &column = m_columns[Comp::id];
+			if constexpr (!std::is_const_v<Comp>)
+			{
+				m_changed_ticks[chunk_i * m_type_info.size() + column.type_index] = currentTick();
+				return *std::launder(reinterpret_cast<Comp *>(m_buffer_stable[chunk_i].data() + column.offset + row * column.stride));
+			}
+			else
+			{
+				return *std::launder(reinterpret_cast<Comp *>(std::as_const(m_buffer_stable[chunk_i]).data() + column.offset + row * column.stride));
+			}
+		}
 	}
 
-	template <class Callable, typename... Comps, std::size_t... Is>
+	//! offsets is either std::array or ConstantOffsets
+	template <class Callable, typename... Comps, class Offsets, std::size_t... Is>
 	void callActionWithOffsets(
-		Callable action, std::byte *args_data,
+		Callable action, std::byte *args_data, const Offsets &offsets,
+		std::index_sequence<Is...>)
+	{
+		action(TermAccess<Comps>::fromBlock(args_data, offsets[Is])...);
+	}
+
+	//! calls action on the first count component blocks of a SoA chunk, the loop runs over plain typed arrays so it can be vectorized
+	template <class Callable, typename... Comps, std::size_t... Is>
+	void callActionOnColumns(
+		Callable &action, std::byte *chunk_data, std::size_t count,
 		const std::array<std::size_t, sizeof...(Comps)> &offsets,
 		std::index_sequence<Is...>)
 	{
-		action((*std::launder(reinterpret_cast<Comps *>(args_data + offsets[Is])))...);
+		std::tuple<typename TermAccess<Comps>::Type *...> columns{TermAccess<Comps>::column(chunk_data, offsets[Is])...};
+		for (std::size_t comp_i = 0; comp_i < count; ++comp_i)
+		{
+			action(TermAccess<Comps>::fromColumn(std::get<Is>(columns), comp_i)...);
+		}
+	}
+
+	template <QueryTerm... Comps>
+	void Archetype::markWritten(std::size_t chunk_i)
+	{
+		auto tick = currentTick();
+		auto mark = [&]<QueryTerm Term>(std::type_identity<Term>)
+		{
+			using Comp = typename TermAccess<Term>::Type;
+			if constexpr (!std::is_const_v<Comp> && !TagComponent<Comp>) //! read only access does not change anything
+			{
+				if (!TermAccess<Term>::optional || hasComponent(Comp::id))
+				{
+					m_changed_ticks[tickIndex(chunk_i, Comp::id)] = tick;
+				}
+			}
+		};
+		(mark(std::type_identity<Comps>{}), ...);
 	}
 
-	template <class Callable, Component... Comps>
+	template <QueryTerm... Comps>
+	std::byte *Archetype::accessChunk(std::size_t chunk_i)
+	{
+		markWritten<Comps...>(chunk_i);
+		constexpr bool writes = ((!std::is_const_v<typename TermAccess<Comps>::Type> && !TagComponent<typename TermAccess<Comps>::Type>) || ...);
+		if constexpr (writes)
+		{
+			return m_buffer_stable[chunk_i].data();
+		}
+		else
+		{
+			return const_cast<std::byte *>(std::as_const(m_buffer_stable[chunk_i]).data()); //! handed out as const only
+		}
+	}
+
+	template <QueryTerm... Comps>
+	std::array<std::size_t, sizeof...(Comps)> Archetype::getOffsets() const
+	{
+		//! in AoS these are offsets inside a block, in SoA offsets of the columns inside a chunk
+		auto offset = [this]<QueryTerm Term>(std::type_identity<Term>)
+		{
+			auto comp_id = TermAccess<Term>::Type::id;
+			if (!hasComponent(comp_id))
+			{
+				assert(TermAccess<Term>::optional); //! required components are always there
+				return MISSING_COLUMN;
+			}
+			return m_columns[comp_id].offset;
+		};
+		return {offset(std::type_identity<Comps>{})...};
+	}
+
+	template <class Callable, QueryTerm... Comps>
 	void Archetype::forEach2(Callable action)
 	{
-		constexpr std::size_t comps_count = sizeof...(Comps);
+		if (m_count == 0)
+		{
+			return;
+		}
+		forEach2<Callable, Comps...>(action, getOffsets<Comps...>());
+	}
 
-		std::array<std::size_t, comps_count> offsets;
-		int k = 0;
-		(..., (offsets.at(k) = m_type2offsets.at(Comps::id), k++)); //! the pack expansion is opposite of what i need???
+	template <class Callable, QueryTerm... Comps>
+	void Archetype::forEach2(Callable action, const std::array<std::size_t, sizeof...(Comps)> &offsets)
+	{
+		forEach2<Callable, Comps...>(action, offsets, 0, usedChunkCount());
+	}
 
-		std::size_t chunk_count = getArrayIndex(m_count - 1) + 1;
-		for (int chunk_i = 0; chunk_i < chunk_count - 1; ++chunk_i)
+	template <class Callable, QueryTerm... Comps>
+	void Archetype::forEach2(Callable action, const std::array<std::size_t, sizeof...(Comps)> &offsets,
+							 std::size_t chunk_begin, std::size_t chunk_end)
+	{
+		static_assert((!SharedComponent<typename TermAccess<Comps>::Type> && ...), "shared components are handed out per chunk by forEachChunk");
+		std::size_t chunk_count = usedChunkCount();
+		assert(chunk_end <= chunk_count);
+		for (std::size_t chunk_i = chunk_begin; chunk_i < chunk_end; ++chunk_i)
 		{
-			auto &chunk = m_buffer_stable.at(chunk_i);
-			std::size_t comps_per_chunk = getBlocksPerChunk();
-			for (int comp_i = 0; comp_i < comps_per_chunk; ++comp_i)
+			//! last chunk need not be full
+			std::size_t block_count = chunk_i + 1 < chunk_count ? getBlocksPerChunk() : m_count_last_chunk;
+			auto chunk_data = accessChunk<Comps...>(chunk_i);
+			if (m_layout == ChunkLayout::SoA)
 			{
-				int entity_offset = comp_i * m_total_size;
-				callActionWithOffsets<Callable, Comps...>(action, chunk.data() + entity_offset, offsets, std::index_sequence_for<Comps...>{});
+				callActionOnColumns<Callable, Comps...>(action, chunk_data, block_count, offsets, std::index_sequence_for<Comps...>{});
+				continue;
+			}
+			for (std::size_t comp_i = 0; comp_i < block_count; ++comp_i)
+			{
+				std::size_t entity_offset = comp_i * m_total_size;
+				callActionWithOffsets<Callable, Comps...>(action, chunk_data + entity_offset, offsets, std::index_sequence_for<Comps...>{});
+			}
+		}
+	}
+
+	template <class Callable, Component... Comps>
+	void Archetype::forEachStatic(Callable action)
+	{
+		static_assert((Comps::static_id && ...));
+		static_assert((!SharedComponent<Comps> && ...), "shared components are handed out per chunk by forEachChunk");
+		constexpr auto offsets = staticBlockOffsets<Comps...>();
+		assert(m_layout == ChunkLayout::AoS && getOffsets<Comps...>() == offsets &&
+			   m_type_info.size() == (std::size_t{!TagComponent<Comps>} + ... + 0));
+
+		std::size_t chunk_count = usedChunkCount();
+		for (std::size_t chunk_i = 0; chunk_i < chunk_count; ++chunk_i)
+		{
+			std::size_t block_count = chunk_i + 1 < chunk_count ? getBlocksPerChunk() : m_count_last_chunk;
+			auto chunk_data = accessChunk<Comps...>(chunk_i);
+			for (std::size_t comp_i = 0; comp_i < block_count; ++comp_i)
+			{
+				callActionWithOffsets<Callable, Comps...>(action, chunk_data + comp_i * m_total_size,
+														  ConstantOffsets<offsets>{}, std::index_sequence_for<Comps...>{});
 			}
 		}
+	}
 
-		//! last chunk is not full so we iterate separately
-		auto &last_chunk = m_buffer_stable.at(chunk_count - 1);
-		for (int comp_i = 0; comp_i < m_count_last_chunk; ++comp_i)
+	template <class Callable, Component... Comps>
+	void Archetype::forEachChunk(Callable action, const std::array<std::size_t, sizeof...(Comps)> &offsets,
+								 std::size_t chunk_begin, std::size_t chunk_end)
+	{
+		std::size_t chunk_count = usedChunkCount();
+		assert(chunk_end <= chunk_count);
+		for (std::size_t chunk_i = chunk_begin; chunk_i < chunk_end; ++chunk_i)
 		{
-			int entity_offset = comp_i * m_total_size;
-			callActionWithOffsets<Callable, Comps...>(action, last_chunk.data() + entity_offset, offsets, std::index_sequence_for<Comps...>{});
+			std::size_t block_count = chunk_i + 1 < chunk_count ? getBlocksPerChunk() : m_count_last_chunk;
+			std::span<const EntityId> ids(m_buffer2entity_id.data() + chunk_i * getBlocksPerChunk(), block_count);
+			auto chunk_data = accessChunk<Comps...>(chunk_i);
+
+			auto view = [&]<Component Comp>(std::type_identity<Comp>, std::size_t offset) -> decltype(auto)
+			{
+				if constexpr (SharedComponent<Comp>) //! one value for the whole chunk
+				{
+					return getShared<Comp>();
+				}
+				else if constexpr (TagComponent<Comp>) //! all rows share the tag instance
+				{
+					return ColumnView<Comp>(reinterpret_cast<std::byte *>(&tagInstance<Comp>()), 0, block_count);
+				}
+				else
+				{
+					return ColumnView<Comp>(chunk_data + offset, m_layout == ChunkLayout::SoA ? sizeof(Comp) : m_total_size, block_count);
+				}
+			};
+			[&]<std::size_t... Is>(std::index_sequence<Is...>)
+			{
+				action(ids, view(std::type_identity<Comps>{}, offsets[Is])...);
+			}(std::index_sequence_for<Comps...>{});
 		}
 	}
 
@@ -240,31 +981,102 @@ namespace ecs
 	template <Component... Comps>
 	void Archetype::addEntity2(std::size_t entity_id, Comps&&... data)
 	{
-		assert(!m_entities.contains(entity_id));
+		auto comp_i = pushBackBlock(entity_id);
 
-		if (needsAnotherChunk())
+		auto construct = [&]<Component Comp>(Comp &&comp)
 		{
-			m_buffer_stable.emplace_back(); //! create new chunk
-			m_count_last_chunk = 0;
+			if constexpr (!TagComponent<Comp> && !SharedComponent<Comp>) //! tags have no storage, shared values are set up front
+			{
+				std::construct_at(std::launder(reinterpret_cast<Comp *>(getComponentData(comp_i, Comp::id))), std::move(comp));
+			}
+		};
+		(construct(std::forward<Comps>(data)), ...);
+		markBlocks(comp_i, comp_i + 1, true);
+	}
+
+	template <Component... Comps>
+	void Archetype::addEntities(std::span<const EntityId> ids, const Comps &...prototypes)
+	{
+		if (ids.empty())
+		{
+			return;
+		}
+		auto first_comp_i = pushBackBlocks(ids);
+		auto end_comp_i = first_comp_i + ids.size();
+		for (auto comp_i = first_comp_i; comp_i < end_comp_i; ++comp_i)
+		{
+			setLocation(comp_i);
 		}
-		auto &chunk = m_buffer_stable.at(getArrayIndex(m_count));
-		auto entity_offset = getIndexInArray(m_count);
-		assert(entity_offset + m_total_size <= COMPONENT_CHUNK_SIZE); //! NO DATA OUTSIDE OF THE CHUNK!
 
-		//! fold expression to construct all Comps... data at their respective offsets
-		std::size_t offset = 0;
-		(
-			(
-				offset = entity_offset + m_type2offsets.at(Comps::id),
-				std::construct_at(std::launder(reinterpret_cast<Comps *>(chunk.data() + offset)), std::forward<Comps>(data))),
-			...);
-
-		m_entities[entity_id] = m_buffer2entity_id.size();
-		m_buffer2entity_id.push_back(entity_id);
-
-		m_count++;
-		m_count_last_chunk++;
-		assert(getIndexInArray(m_count - 1) == (m_count_last_chunk - 1) * m_total_size);
+		auto construct_column = [&]<Component Comp>(const Comp &prototype)
+		{
+			if constexpr (TagComponent<Comp> || SharedComponent<Comp>) //! tags have no storage, shared values are set up front
+			{
+				return;
+			}
+			else
+			{
+				const auto &column = getColumn(Comp::id);
+				for (auto comp_i = first_comp_i; comp_i < end_comp_i;)
+				{
+					//! blocks which are in the same chunk
+					auto chunk_end_i = std::min(end_comp_i, (getArrayIndex(comp_i) + 1) * getBlocksPerChunk());
+					auto column_data = m_buffer_stable[getArrayIndex(comp_i)].data() + column.offset;
+					for (auto row = getIndexInArray(comp_i); comp_i < chunk_end_i; ++comp_i, ++row)
+					{
+						std::construct_at(std::launder(reinterpret_cast<Comp *>(column_data + row * column.stride)), prototype);
+					}
+				}
+			}
+		};
+		(construct_column(prototypes), ...);
+		markBlocks(first_comp_i, end_comp_i, true);
+	}
+
+	template <Component... Comps, typename Init>
+		requires std::invocable<Init &, std::size_t, InitParam<Comps>...>
+	void Archetype::addEntities(std::span<const EntityId> ids, Init &init, const Comps &...prototypes)
+	{
+		auto first_comp_i = m_count;
+		addEntities(ids, prototypes...);
+
+		//! columns are looked up once, tags and shared components get handed their prototype
+		auto column_of = [&]<Component Comp>(const Comp &) -> Column
+		{
+			if constexpr (TagComponent<Comp> || SharedComponent<Comp>)
+			{
+				return {};
+			}
+			else
+			{
+				return getColumn(Comp::id);
+			}
+		};
+		std::array<Column, sizeof...(Comps)> columns{column_of(prototypes)...};
+		auto param = [&]<Component Comp>(std::byte *chunk_data, std::size_t row, const Column &column, const Comp &prototype) -> InitParam<Comp>
+		{
+			if constexpr (TagComponent<Comp> || SharedComponent<Comp>)
+			{
+				return prototype;
+			}
+			else
+			{
+				return *std::launder(reinterpret_cast<Comp *>(chunk_data + column.offset + row * column.stride));
+			}
+		};
+		auto init_chunk = [&]<std::size_t... Is>(std::index_sequence<Is...>)
+		{
+			for (auto comp_i = first_comp_i; comp_i < m_count;)
+			{
+				auto chunk_end_i = std::min(m_count, (getArrayIndex(comp_i) + 1) * getBlocksPerChunk());
+				auto chunk_data = m_buffer_stable[getArrayIndex(comp_i)].data();
+				for (auto row = getIndexInArray(comp_i); comp_i < chunk_end_i; ++comp_i, ++row)
+				{
+					init(comp_i - first_comp_i, param(chunk_data, row, columns[Is], prototypes)...);
+				}
+			}
+		};
+		init_chunk(std::index_sequence_for<Comps...>{});
 	}
 
 } // namespace ecs
\ No newline at end of file
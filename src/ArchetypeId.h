@@ -0,0 +1,200 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <span>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+
+namespace ecs
+{
+
+    //! component ids are stored as 16 bit numbers
+    using ComponentIndex = std::uint16_t;
+    constexpr int MAX_COMPONENT_COUNT = 1 << 16;
+
+    //! Set of component ids of an archetype.
+    //! Ids are kept sorted, up to INLINE_CAPACITY of them inline and more on the heap, so the size of an id depends
+    //! only on the number of components in it and not on the number of component types.
+    //! The hash and a 64 bit summary (bit id % 64 set for each id) are kept up to date, the summary rejects most
+    //! failing subset and intersection tests without looking at the ids.
+    class ArchetypeId
+    {
+    public:
+        static constexpr std::size_t INLINE_CAPACITY = 10;
+
+        constexpr ArchetypeId() = default;
+        constexpr ArchetypeId(std::initializer_list<int> comp_ids)
+        {
+            for (auto comp_id : comp_ids)
+            {
+                set(comp_id);
+            }
+        }
+
+        constexpr bool test(int comp_id) const
+        {
+            if ((m_summary & summaryBit(comp_id)) == 0)
+            {
+                return false;
+            }
+            auto ids = this->ids();
+            return std::binary_search(ids.begin(), ids.end(), static_cast<ComponentIndex>(comp_id));
+        }
+
+        constexpr void set(int comp_id)
+        {
+            assert(comp_id >= 0 && comp_id < MAX_COMPONENT_COUNT);
+            if (test(comp_id))
+            {
+                return;
+            }
+
+            auto ids = this->ids();
+            auto pos = std::lower_bound(ids.begin(), ids.end(), static_cast<ComponentIndex>(comp_id)) - ids.begin();
+            if (m_size < INLINE_CAPACITY)
+            {
+                std::copy_backward(m_inline.begin() + pos, m_inline.begin() + m_size, m_inline.begin() + m_size + 1);
+                m_inline[pos] = static_cast<ComponentIndex>(comp_id);
+            }
+            else
+            {
+                if (m_size == INLINE_CAPACITY) //! does not fit inline anymore
+                {
+                    m_spilled.assign(m_inline.begin(), m_inline.end());
+                }
+                m_spilled.insert(m_spilled.begin() + pos, static_cast<ComponentIndex>(comp_id));
+            }
+            m_size++;
+            update();
+        }
+
+        constexpr void reset(int comp_id)
+        {
+            if (!test(comp_id))
+            {
+                return;
+            }
+
+            auto ids = this->ids();
+            auto pos = std::lower_bound(ids.begin(), ids.end(), static_cast<ComponentIndex>(comp_id)) - ids.begin();
+            if (m_size <= INLINE_CAPACITY)
+            {
+                std::copy(m_inline.begin() + pos + 1, m_inline.begin() + m_size, m_inline.begin() + pos);
+            }
+            else
+            {
+                m_spilled.erase(m_spilled.begin() + pos);
+                if (m_spilled.size() == INLINE_CAPACITY) //! fits inline again
+                {
+                    std::copy(m_spilled.begin(), m_spilled.end(), m_inline.begin());
+                    m_spilled = {};
+                }
+            }
+            m_size--;
+            update();
+        }
+
+        //! \returns sorted ids of the components
+        constexpr std::span<const ComponentIndex> ids() const
+        {
+            if (m_size <= INLINE_CAPACITY)
+            {
+                return {m_inline.data(), m_size};
+            }
+            return {m_spilled.data(), m_spilled.size()};
+        }
+
+        constexpr std::size_t count() const
+        {
+            return m_size;
+        }
+
+        constexpr bool none() const
+        {
+            return m_size == 0;
+        }
+
+        constexpr std::size_t hash() const
+        {
+            return m_hash;
+        }
+
+        //! \returns true if the ids have a component in common
+        constexpr bool intersects(const ArchetypeId &other) const
+        {
+            if ((m_summary & other.m_summary) == 0)
+            {
+                return false;
+            }
+            auto a = ids();
+            auto b = other.ids();
+            for (auto a_it = a.begin(), b_it = b.begin(); a_it != a.end() && b_it != b.end();)
+            {
+                if (*a_it == *b_it)
+                {
+                    return true;
+                }
+                *a_it < *b_it ? ++a_it : ++b_it;
+            }
+            return false;
+        }
+
+        friend constexpr bool operator==(const ArchetypeId &first, const ArchetypeId &second)
+        {
+            return first.m_hash == second.m_hash && std::ranges::equal(first.ids(), second.ids());
+        }
+
+        //! this operator means: first IS CONTAINED in second
+        //! for instance Archetype: AB IS CONTAINED in ABCD and ABD but not in AD
+        //! when this is true then action with ArchetypeId second should be called when ArchetypeId first is called
+        friend constexpr bool operator<=(const ArchetypeId &first, const ArchetypeId &second)
+        {
+            if (first.m_size > second.m_size || (first.m_summary & ~second.m_summary) != 0)
+            {
+                return false;
+            }
+            auto first_ids = first.ids();
+            auto second_ids = second.ids();
+            return std::includes(second_ids.begin(), second_ids.end(), first_ids.begin(), first_ids.end());
+        }
+
+    private:
+        static constexpr std::uint64_t summaryBit(int comp_id)
+        {
+            return std::uint64_t{1} << (comp_id % 64);
+        }
+
+        //! recomputes summary and hash (FNV-1a over the ids)
+        constexpr void update()
+        {
+            m_summary = 0;
+            m_hash = 14695981039346656037ull;
+            for (auto comp_id : ids())
+            {
+                m_summary |= summaryBit(comp_id);
+                m_hash = (m_hash ^ comp_id) * 1099511628211ull;
+            }
+        }
+
+        std::uint64_t m_summary = 0;
+        std::size_t m_hash = 14695981039346656037ull;
+        std::array<ComponentIndex, INLINE_CAPACITY> m_inline{}; //!< ids if there are at most INLINE_CAPACITY of them
+        std::uint32_t m_size = 0;
+        std::vector<ComponentIndex> m_spilled; //!< ids if there are more than INLINE_CAPACITY of them
+    };
+
+} // namespace ecs
+
+template <>
+struct std::hash<ecs::ArchetypeId>
+{
+    std::size_t operator()(const ecs::ArchetypeId &id) const noexcept
+    {
+        return id.hash();
+    }
+};
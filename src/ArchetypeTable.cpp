@@ -0,0 +1,192 @@
+#include "ArchetypeTable.h"
+
+#include <stdexcept>
+
+namespace ecs
+{
+
+    namespace
+    {
+        //! key of an archetype in the table of shared values
+        std::size_t valuesKey(const ArchetypeId &id, const std::vector<Archetype::SharedValue> &shared)
+        {
+            auto key = id.hash();
+            for (auto &value : shared)
+            {
+                key ^= value.hash + 0x9e3779b97f4a7c15 + (key << 6) + (key >> 2);
+            }
+            return key;
+        }
+    } // namespace
+
+    ArchetypeIndex ArchetypeTable::find(const ArchetypeId &id) const
+    {
+        if (m_slots.empty())
+        {
+            return NO_ARCHETYPE;
+        }
+
+        auto mask = m_slots.size() - 1;
+        for (auto slot_i = id.hash() & mask;; slot_i = (slot_i + 1) & mask)
+        {
+            auto &slot = m_slots[slot_i];
+            if (slot.index == NO_ARCHETYPE)
+            {
+                return NO_ARCHETYPE;
+            }
+            if (slot.hash == id.hash() && m_signatures[slot.index] == id)
+            {
+                return slot.index;
+            }
+        }
+    }
+
+    ArchetypeIndex ArchetypeTable::find(const ArchetypeId &id, const std::vector<Archetype::SharedValue> &shared) const
+    {
+        if (shared.empty())
+        {
+            return find(id); //! without shared components the signature alone identifies the archetype
+        }
+        if (m_value_slots.empty())
+        {
+            return NO_ARCHETYPE;
+        }
+
+        auto key = valuesKey(id, shared);
+        auto mask = m_value_slots.size() - 1;
+        for (auto slot_i = key & mask;; slot_i = (slot_i + 1) & mask)
+        {
+            auto &slot = m_value_slots[slot_i];
+            if (slot.index == NO_ARCHETYPE)
+            {
+                return NO_ARCHETYPE;
+            }
+            if (slot.hash == key && m_signatures[slot.index] == id && m_archetypes[slot.index].sharedValues() == shared)
+            {
+                return slot.index;
+            }
+        }
+    }
+
+    ArchetypeIndex ArchetypeTable::next(ArchetypeIndex index) const
+    {
+        return m_next.at(index);
+    }
+
+    ArchetypeIndex ArchetypeTable::create(const ArchetypeId &id, const std::vector<Archetype::SharedValue> &shared)
+    {
+        assert(m_archetypes.size() < NO_ARCHETYPE);
+
+        auto first = find(id);
+        auto index = static_cast<ArchetypeIndex>(m_archetypes.size());
+        m_archetypes.emplace_back();
+        m_signatures.push_back(id);
+        m_next.push_back(NO_ARCHETYPE);
+
+        if (!shared.empty())
+        {
+            auto key = valuesKey(id, shared);
+            m_valued.emplace_back(key, index);
+            if (2 * m_valued.size() > m_value_slots.size())
+            {
+                growValues(); //! reinserts the new one too
+            }
+            else
+            {
+                insert(m_value_slots, key, index);
+            }
+        }
+
+        if (first != NO_ARCHETYPE) //! the signature is in the slots already
+        {
+            auto last = first;
+            while (m_next[last] != NO_ARCHETYPE)
+            {
+                last = m_next[last];
+            }
+            m_next[last] = index;
+            return index;
+        }
+
+        if (2 * m_signatures.size() > m_slots.size())
+        {
+            grow(); //! reinserts the new one too
+        }
+        else
+        {
+            insert(m_slots, id.hash(), index);
+        }
+        return index;
+    }
+
+    void ArchetypeTable::grow()
+    {
+        m_slots.assign(std::max<std::size_t>(16, 2 * m_slots.size()), Slot{});
+        for (ArchetypeIndex index = 0; index < m_signatures.size(); ++index)
+        {
+            //! only the first archetype of each signature goes into the slots, it has the lowest index
+            if (find(m_signatures[index]) == NO_ARCHETYPE)
+            {
+                insert(m_slots, m_signatures[index].hash(), index);
+            }
+        }
+    }
+
+    void ArchetypeTable::growValues()
+    {
+        m_value_slots.assign(std::max<std::size_t>(16, 2 * m_value_slots.size()), Slot{});
+        for (auto [key, index] : m_valued)
+        {
+            insert(m_value_slots, key, index);
+        }
+    }
+
+    void ArchetypeTable::insert(std::vector<Slot> &slots, std::size_t hash, ArchetypeIndex index)
+    {
+        auto mask = slots.size() - 1;
+        auto slot_i = hash & mask;
+        while (slots[slot_i].index != NO_ARCHETYPE)
+        {
+            slot_i = (slot_i + 1) & mask;
+        }
+        slots[slot_i] = {.hash = hash, .index = index};
+    }
+
+    Archetype &ArchetypeTable::operator[](ArchetypeIndex index)
+    {
+        assert(index < m_archetypes.size());
+        return m_archetypes[index];
+    }
+
+    const Archetype &ArchetypeTable::operator[](ArchetypeIndex index) const
+    {
+        assert(index < m_archetypes.size());
+        return m_archetypes[index];
+    }
+
+    const ArchetypeId &ArchetypeTable::signature(ArchetypeIndex index) const
+    {
+        return m_signatures.at(index);
+    }
+
+    Archetype &ArchetypeTable::at(const ArchetypeId &id)
+    {
+        auto index = find(id);
+        if (index == NO_ARCHETYPE)
+        {
+            throw std::out_of_range("no archetype with the given components");
+        }
+        return m_archetypes[index];
+    }
+
+    bool ArchetypeTable::contains(const ArchetypeId &id) const
+    {
+        return find(id) != NO_ARCHETYPE;
+    }
+
+    std::size_t ArchetypeTable::size() const
+    {
+        return m_archetypes.size();
+    }
+
+} // namespace ecs
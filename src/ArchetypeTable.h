@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Archetype.h"
+
+#include <deque>
+#include <vector>
+
+namespace ecs
+{
+
+    //! Stores all archetypes of a world in a dense, stable sequence indexed by ArchetypeIndex.
+    //! Archetypes never move once created (queries and edges keep pointers to them).
+    //! Signatures are mapped to indices by a flat open addressing table (linear probing), which is needed only
+    //! when an archetype is looked up by its components, i.e. on creation of entities and archetypes.
+    //! Archetypes with shared components may share a signature (they differ by the shared values), the table maps
+    //! the signature to the first of them and the others follow in a list, see next.
+    //! They are also kept in a second table keyed by signature and hashes of their shared values, so that looking up
+    //! the archetype of a value does not walk the list, which gets long for components with many values.
+    class ArchetypeTable
+    {
+    public:
+        //! \returns index of the first archetype with signature id or NO_ARCHETYPE
+        ArchetypeIndex find(const ArchetypeId &id) const;
+
+        //! \returns index of the archetype with signature id and the values shared (sorted by id) or NO_ARCHETYPE
+        ArchetypeIndex find(const ArchetypeId &id, const std::vector<Archetype::SharedValue> &shared) const;
+
+        //! \returns index of the next archetype with the same signature as index or NO_ARCHETYPE
+        ArchetypeIndex next(ArchetypeIndex index) const;
+
+        //! creates an archetype with signature id, its components and the values shared still need to be registered
+        //! (setSharedValues with the same values) before the next lookup
+        //! if there are archetypes with this signature already, the new one gets appended to their list
+        //! \returns index of the new archetype
+        ArchetypeIndex create(const ArchetypeId &id, const std::vector<Archetype::SharedValue> &shared = {});
+
+        Archetype &operator[](ArchetypeIndex index);
+        const Archetype &operator[](ArchetypeIndex index) const;
+
+        const ArchetypeId &signature(ArchetypeIndex index) const;
+
+        //! \returns archetype with signature id
+        //! \throws std::out_of_range if there is none
+        Archetype &at(const ArchetypeId &id);
+
+        bool contains(const ArchetypeId &id) const;
+
+        std::size_t size() const;
+
+    private:
+        struct Slot
+        {
+            std::size_t hash = 0;
+            ArchetypeIndex index = NO_ARCHETYPE; //!< NO_ARCHETYPE marks an empty slot
+        };
+
+        //! doubles the slot count and reinserts all archetypes
+        void grow();
+        //! doubles the slot count of m_value_slots and reinserts all archetypes with shared values
+        void growValues();
+        static void insert(std::vector<Slot> &slots, std::size_t hash, ArchetypeIndex index);
+
+        std::deque<Archetype> m_archetypes;     //!< indexed by ArchetypeIndex, deque keeps them in place when growing
+        std::vector<ArchetypeId> m_signatures; //!< signature of each archetype
+        std::vector<ArchetypeIndex> m_next;    //!< next archetype with the same signature
+        std::vector<Slot> m_slots;             //!< power of two sized, at most half full
+
+        std::vector<std::pair<std::size_t, ArchetypeIndex>> m_valued; //!< archetypes with shared values and their keys
+        std::vector<Slot> m_value_slots;                               //!< the same for m_valued
+    };
+
+} // namespace ecs
@@ -0,0 +1,119 @@
+#include "ChunkPool.h"
+
+#include <cassert>
+#include <new>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace ecs
+{
+
+    ChunkPool::ChunkPool(std::size_t chunk_size, ChunkBacking backing)
+        //! chunks must stay aligned when placed one after another in a slab
+        : m_chunk_size((chunk_size + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT), m_backing(backing)
+    {
+#if !defined(__linux__)
+        m_backing = ChunkBacking::Heap; //! no portable way to ask for huge pages
+#endif
+        assert(m_chunk_size <= SLAB_SIZE || m_backing == ChunkBacking::Heap);
+    }
+
+    ChunkPool::~ChunkPool()
+    {
+        trim();
+#if defined(__linux__)
+        for (auto slab : m_slabs)
+        {
+            munmap(slab, SLAB_SIZE);
+        }
+#endif
+    }
+
+    std::byte *ChunkPool::allocate()
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_free_chunks.empty())
+        {
+            auto chunk = m_free_chunks.back();
+            m_free_chunks.pop_back();
+            return chunk;
+        }
+        return m_backing == ChunkBacking::HugePages ? allocateFromSlab() : allocateFromSystem();
+    }
+
+    void ChunkPool::release(std::byte *chunk)
+    {
+        assert(chunk);
+        std::lock_guard lock(m_mutex);
+        m_free_chunks.push_back(chunk);
+    }
+
+    std::size_t ChunkPool::trim()
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_backing == ChunkBacking::HugePages)
+        {
+            return 0; //! slabs cannot be returned partially
+        }
+
+        std::size_t freed_bytes = m_free_chunks.size() * m_chunk_size;
+        for (auto chunk : m_free_chunks)
+        {
+            ::operator delete(chunk, std::align_val_t{CHUNK_ALIGNMENT});
+        }
+        m_free_chunks.clear();
+        return freed_bytes;
+    }
+
+    std::size_t ChunkPool::chunkSize() const
+    {
+        return m_chunk_size;
+    }
+
+    std::size_t ChunkPool::cachedCount() const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_free_chunks.size();
+    }
+
+    std::byte *ChunkPool::allocateFromSystem()
+    {
+        //! no value initialization -> pages get touched only when components are written
+        return static_cast<std::byte *>(::operator new(m_chunk_size, std::align_val_t{CHUNK_ALIGNMENT}));
+    }
+
+    std::byte *ChunkPool::allocateFromSlab()
+    {
+#if defined(__linux__)
+        if (m_slab_offset + m_chunk_size > SLAB_SIZE)
+        {
+            //! over-allocate so that the slab can start at a huge page boundary
+            void *mapping = mmap(nullptr, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+            auto address = reinterpret_cast<std::uintptr_t>(mapping);
+            auto aligned = (address + SLAB_SIZE - 1) / SLAB_SIZE * SLAB_SIZE;
+            if (aligned > address)
+            {
+                munmap(mapping, aligned - address);
+            }
+            munmap(reinterpret_cast<void *>(aligned + SLAB_SIZE), address + SLAB_SIZE - aligned);
+            madvise(reinterpret_cast<void *>(aligned), SLAB_SIZE, MADV_HUGEPAGE);
+
+            m_slabs.push_back(reinterpret_cast<std::byte *>(aligned));
+            m_slab_offset = 0;
+        }
+        auto chunk = m_slabs.back() + m_slab_offset;
+        m_slab_offset += m_chunk_size;
+        return chunk;
+#else
+        return allocateFromSystem();
+#endif
+    }
+
+} // namespace ecs
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <mutex>
+
+namespace ecs
+{
+
+#ifndef CHUNK_ALIGNMENT
+#define CHUNK_ALIGNMENT 64
+#endif
+
+    //! where the memory of chunks comes from
+    enum class ChunkBacking
+    {
+        Heap,     //!< every chunk is a separate aligned heap allocation
+        HugePages //!< chunks are carved from 2MB slabs backed by transparent huge pages (where supported)
+    };
+
+    //! Hands out uninitialized CHUNK_ALIGNMENT aligned chunks of chunk_size bytes and takes them back for reuse.
+    //! Released chunks are kept in a free-list so that new chunks usually do not hit the system allocator.
+    class ChunkPool
+    {
+    public:
+        explicit ChunkPool(std::size_t chunk_size, ChunkBacking backing = ChunkBacking::Heap);
+        ~ChunkPool(); //!< all chunks must have been released already
+
+        ChunkPool(const ChunkPool &) = delete;
+        ChunkPool &operator=(const ChunkPool &) = delete;
+
+        std::byte *allocate();
+        void release(std::byte *chunk);
+
+        //! returns cached chunks to the system
+        //! \returns number of bytes freed
+        std::size_t trim();
+
+        std::size_t chunkSize() const;
+        //! \returns number of released chunks waiting for reuse
+        std::size_t cachedCount() const;
+
+    private:
+        std::byte *allocateFromSystem();
+        std::byte *allocateFromSlab();
+
+        static constexpr std::size_t SLAB_SIZE = std::size_t{2} << 20; //! size of a huge page
+
+        std::size_t m_chunk_size;
+        ChunkBacking m_backing;
+
+        mutable std::mutex m_mutex;
+        std::vector<std::byte *> m_free_chunks; //!< released chunks
+        std::vector<std::byte *> m_slabs;       //!< huge page slabs, freed only in destructor
+        std::size_t m_slab_offset = SLAB_SIZE;  //!< first unused byte of the last slab
+    };
+
+} // namespace ecs
@@ -0,0 +1,26 @@
+#include "CommandBuffer.h"
+
+namespace ecs
+{
+
+    void CommandBuffer::removeEntity(EntityId entity_id)
+    {
+        m_commands.push_back({.kind = Kind::RemoveEntity, .entity_id = entity_id});
+    }
+
+    bool CommandBuffer::empty() const
+    {
+        return m_commands.empty();
+    }
+
+    std::size_t CommandBuffer::size() const
+    {
+        return m_commands.size();
+    }
+
+    void CommandBuffer::clear()
+    {
+        m_commands.clear();
+    }
+
+} // namespace ecs
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Archetype.h"
+
+#include <functional>
+
+namespace ecs
+{
+
+    struct EntityWorld;
+
+    //! Records structural changes so that EntityWorld::flush can apply them later in a batch.
+    //! Recording does not touch the world, so it is safe inside of forEach callbacks.
+    //! A buffer is not synchronized, every thread should record into its own (see EntityWorld::commands).
+    class CommandBuffer
+    {
+    public:
+        template <Component... Comps>
+        void addEntity(Comps &&...comps);
+
+        void removeEntity(EntityId entity_id);
+
+        template <Component Comp>
+        void addComponent(EntityId entity_id, Comp comp);
+
+        template <Component Comp>
+        void removeComponent(EntityId entity_id);
+
+        bool empty() const;
+        std::size_t size() const;
+        void clear();
+
+    private:
+        friend struct EntityWorld;
+
+        //! commands of the same kind get applied together, in this order
+        enum class Kind
+        {
+            AddComponent,
+            RemoveComponent,
+            RemoveEntity,
+            AddEntity
+        };
+
+        using EdgeGetter = Archetype::Edge &(*)(EntityWorld &world, ArchetypeIndex archetype);
+
+        struct Command
+        {
+            Kind kind;
+            EntityId entity_id = 0;
+            int comp_id = -1;
+            EdgeGetter get_edge = nullptr;                       //!< add/remove edge of the component
+            void (*destroy)(void *obj) = nullptr;                //!< destructor of the added component
+            std::function<void(std::byte *dest)> construct = {}; //!< moves the added component into dest, empty for tags
+            std::function<void(EntityWorld &world)> create = {}; //!< adds the new entity or applies the whole command
+        };
+
+        template <class World, Component Comp>
+        static Archetype::Edge &getAddEdge(World &world, ArchetypeIndex archetype)
+        {
+            return world.template getAddEdge<Comp>(archetype);
+        }
+        template <class World, Component Comp>
+        static Archetype::Edge &getRemoveEdge(World &world, ArchetypeIndex archetype)
+        {
+            return world.template getRemoveEdge<Comp>(archetype);
+        }
+
+        std::vector<Command> m_commands;
+    };
+
+    template <Component... Comps>
+    void CommandBuffer::addEntity(Comps &&...comps)
+    {
+        Command command{.kind = Kind::AddEntity};
+        command.create = [... comps = std::forward<Comps>(comps)](auto &world) mutable
+        {
+            world.addEntity(std::move(comps)...);
+        };
+        m_commands.push_back(std::move(command));
+    }
+
+    template <Component Comp>
+    void CommandBuffer::addComponent(EntityId entity_id, Comp comp)
+    {
+        if constexpr (SharedComponent<Comp>) //! the target archetype depends on the value, so there is no edge to go along
+        {
+            Command command{.kind = Kind::AddComponent, .entity_id = entity_id, .comp_id = Comp::id};
+            command.create = [entity_id, comp = std::move(comp)](auto &world) mutable
+            {
+                world.addComponent(entity_id, std::move(comp));
+            };
+            m_commands.push_back(std::move(command));
+        }
+        else
+        {
+            Command command{.kind = Kind::AddComponent,
+                            .entity_id = entity_id,
+                            .comp_id = Comp::id,
+                            .get_edge = &getAddEdge<EntityWorld, Comp>};
+            if constexpr (!TagComponent<Comp>) //! tags have no storage
+            {
+                command.destroy = &CompTypeInfo::destroy_s<Comp>;
+                command.construct = [comp = std::move(comp)](std::byte *dest) mutable
+                {
+                    std::construct_at(std::launder(reinterpret_cast<Comp *>(dest)), std::move(comp));
+                };
+            }
+            m_commands.push_back(std::move(command));
+        }
+    }
+
+    template <Component Comp>
+    void CommandBuffer::removeComponent(EntityId entity_id)
+    {
+        m_commands.push_back({.kind = Kind::RemoveComponent,
+                              .entity_id = entity_id,
+                              .comp_id = Comp::id,
+                              .get_edge = &getRemoveEdge<EntityWorld, Comp>});
+    }
+
+} // namespace ecs
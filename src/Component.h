@@ -5,13 +5,49 @@
 namespace ecs
 {
 
-    template <class Comp>
+#ifndef STATIC_COMPONENT_ID_COUNT
+#define STATIC_COMPONENT_ID_COUNT 16
+#endif
+
+    //! ids below this are reserved for components with static ids, REGISTER assigns the rest
+    constexpr int FIRST_DYNAMIC_COMPONENT_ID = STATIC_COMPONENT_ID_COUNT;
+
+    //! StaticId of components whose id gets assigned at runtime by REGISTER
+    constexpr int DYNAMIC_COMPONENT_ID = -1;
+
+    //! base of every component: struct Comp : CompTag<Comp, StaticId>
+    //! StaticId makes Comp::id a constant expression which does not depend on link or initialization order
+    //! so it stays the same across builds, it has to be unique and below STATIC_COMPONENT_ID_COUNT
+    template <class Comp, int StaticId = DYNAMIC_COMPONENT_ID>
     struct CompTag
     {
+        static_assert(StaticId >= 0 && StaticId < FIRST_DYNAMIC_COMPONENT_ID, "static component id out of the reserved range");
+
+        using component_type = Comp;
+        static constexpr bool static_id = true;
+        static constexpr int id = StaticId;
+    };
+
+    //! without StaticId the id is assigned during static initialization by REGISTER(Comp)
+    template <class Comp>
+    struct CompTag<Comp, DYNAMIC_COMPONENT_ID>
+    {
+        using component_type = Comp;
+        static constexpr bool static_id = false;
         static int id;
         inline static int id2 = 0;
     };
 
+    //! base of shared components: struct Comp : SharedCompTag<Comp, StaticId>
+    //! all entities of a chunk have the same value of a shared component, which is stored once and not per entity
+    //! entities with different values land in different chunks, the values need operator== and either a std::hash
+    //! specialization or a std::size_t hash() const member (equal values must have equal hashes)
+    template <class Comp, int StaticId = DYNAMIC_COMPONENT_ID>
+    struct SharedCompTag : CompTag<Comp, StaticId>
+    {
+        static constexpr bool shared = true;
+    };
+
     class TypeIdGenerator
     {
     public:
@@ -23,7 +59,7 @@ namespace ecs
         }
 
     private:
-        inline static int m_count = 0;
+        inline static int m_count = FIRST_DYNAMIC_COMPONENT_ID;
     };
 
 #define REGISTER(Comp) \
@@ -37,11 +73,23 @@ namespace ecs
     //! an array of char, unsigned char, or std::byte (17.2.1).36 If the content of that array is copied back into
     //! the object, the object shall subsequently hold its original value.
 
+    //! const qualified components are accepted too, they mark read only access
     template <typename T>
     concept Component =
-        std::is_base_of_v<CompTag<T>, T> &&
-        requires(T t) { T::id; };
+        requires(T t) {
+            typename std::remove_cv_t<T>::component_type;
+            T::id;
+        } &&
+        std::is_same_v<typename std::remove_cv_t<T>::component_type, std::remove_cv_t<T>>;
         // std::is_trivially_copyable_v<T>; //! no more needed :)
+
+    //! components without data members are tags: they exist only in archetype signatures and take no storage
+    template <typename T>
+    concept TagComponent = Component<T> && std::is_empty_v<std::remove_cv_t<T>>;
+
+    //! components derived from SharedCompTag
+    template <typename T>
+    concept SharedComponent = Component<T> && requires { requires std::remove_cv_t<T>::shared; };
         
 
 } // namespace ecs
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "EntityTable.h"
+#include "Serialization.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace ecs
+{
+
+    Entity &EntityTable::create()
+    {
+        //! indices taken by insert in the meantime are skipped
+        while (!m_free_indices.empty() && getSlot(m_free_indices.back()).alive)
+        {
+            m_free_indices.pop_back();
+        }
+
+        std::size_t index;
+        if (m_free_indices.empty())
+        {
+            index = m_used_index_count++;
+            assert(index <= ENTITY_INDEX_MASK);
+        }
+        else
+        {
+            index = m_free_indices.back();
+            m_free_indices.pop_back();
+        }
+
+        auto &slot = getSlot(index);
+        assert(!slot.alive);
+        //! generation of the slot was already increased when the previous entity got destroyed
+        slot.entity = {.id = makeEntityId(index, entityGeneration(slot.entity.id)), .archetype = NO_ARCHETYPE};
+        slot.alive = true;
+        m_count++;
+        return slot.entity;
+    }
+
+    Entity &EntityTable::insert(EntityId id)
+    {
+        auto index = entityIndex(id);
+        //! skipped indices become free, an inserted index which is in the free-list already stays there and gets
+        //! skipped by create
+        for (; m_used_index_count < index; ++m_used_index_count)
+        {
+            m_free_indices.push_back(m_used_index_count);
+        }
+        m_used_index_count = std::max(m_used_index_count, index + 1);
+
+        auto &slot = getSlot(index);
+        if (slot.alive)
+        {
+            throw std::logic_error("EntityTable::insert: index " + std::to_string(index) + " is used by an existing entity");
+        }
+        slot.entity = {.id = id, .archetype = NO_ARCHETYPE};
+        slot.alive = true;
+        m_count++;
+        return slot.entity;
+    }
+
+    void EntityTable::destroy(EntityId id)
+    {
+        at(id); //! throws for stale handles
+        auto &slot = getSlot(entityIndex(id));
+        slot.alive = false;
+        slot.entity.id = makeEntityId(entityIndex(id), entityGeneration(id) + 1);
+        m_free_indices.push_back(entityIndex(id));
+        m_count--;
+    }
+
+    bool EntityTable::contains(EntityId id) const
+    {
+        return findSlot(id) != nullptr;
+    }
+
+    Entity &EntityTable::at(EntityId id)
+    {
+        std::as_const(*this).at(id); //! throws for stale handles
+        return getSlot(entityIndex(id)).entity;
+    }
+
+    const Entity &EntityTable::at(EntityId id) const
+    {
+        auto slot = findSlot(id);
+        if (!slot)
+        {
+            throw std::out_of_range("EntityTable::at: entity " + std::to_string(entityIndex(id)) +
+                                    " of generation " + std::to_string(entityGeneration(id)) + " does not exist");
+        }
+        return slot->entity;
+    }
+
+    std::size_t EntityTable::size() const
+    {
+        return m_count;
+    }
+
+    void EntityTable::save(std::ostream &os) const
+    {
+        writeRaw<std::uint64_t>(os, ENTITY_PAGE_SIZE);
+        writeRaw<std::uint64_t>(os, sizeof(Slot));
+        writeRaw<std::uint64_t>(os, m_used_index_count);
+        writeRaw<std::uint64_t>(os, m_count);
+        writeRaw<std::uint64_t>(os, m_free_indices.size());
+        writeBytes(os, std::as_bytes(std::span(m_free_indices)));
+
+        //! pages skipped by insert were never allocated, they are written as the empty pages getSlot would create
+        static const Page empty_page{};
+        auto page_count = (m_used_index_count + ENTITY_PAGE_SIZE - 1) / ENTITY_PAGE_SIZE;
+        for (std::size_t page_i = 0; page_i < page_count; ++page_i)
+        {
+            writeRaw(os, page_i < m_pages.size() && m_pages[page_i] ? *m_pages[page_i] : empty_page);
+        }
+    }
+
+    void EntityTable::load(std::istream &is)
+    {
+        assert(m_used_index_count == 0); //! table has to be empty
+        if (readRaw<std::uint64_t>(is) != ENTITY_PAGE_SIZE || readRaw<std::uint64_t>(is) != sizeof(Slot))
+        {
+            throw std::runtime_error("world snapshot was written with a different entity record layout");
+        }
+        auto used_index_count = readRaw<std::uint64_t>(is);
+        auto count = readRaw<std::uint64_t>(is);
+        if (used_index_count > ENTITY_INDEX_MASK + 1 || count > used_index_count)
+        {
+            throw std::runtime_error("world snapshot has invalid entity counts");
+        }
+        auto free_indices = readVector<std::size_t>(is, readRaw<std::uint64_t>(is));
+        if (std::ranges::any_of(free_indices, [&](std::size_t index)
+                                { return index >= used_index_count; }))
+        {
+            throw std::runtime_error("world snapshot has a free entity index out of range");
+        }
+
+        //! pages are read one by one, a count larger than the stream fails at its end
+        std::vector<std::shared_ptr<Page>> pages;
+        std::size_t alive_count = 0;
+        auto page_count = (used_index_count + ENTITY_PAGE_SIZE - 1) / ENTITY_PAGE_SIZE;
+        for (std::size_t page_i = 0; page_i < page_count; ++page_i)
+        {
+            auto page = std::make_shared<Page>();
+            readBytes(is, std::as_writable_bytes(std::span(page->data(), page->size())));
+            for (std::size_t slot_i = 0; slot_i < page->size(); ++slot_i)
+            {
+                auto &slot = (*page)[slot_i];
+                if (*reinterpret_cast<const unsigned char *>(&slot.alive) > 1) //! not a valid bool
+                {
+                    throw std::runtime_error("world snapshot has an invalid entity record");
+                }
+                if (slot.alive && (page_i * ENTITY_PAGE_SIZE + slot_i >= used_index_count ||
+                                   entityIndex(slot.entity.id) != page_i * ENTITY_PAGE_SIZE + slot_i))
+                {
+                    throw std::runtime_error("world snapshot has an invalid entity record");
+                }
+                alive_count += slot.alive;
+            }
+            pages.push_back(std::move(page));
+        }
+        if (alive_count != count)
+        {
+            throw std::runtime_error("world snapshot has invalid entity counts");
+        }
+
+        m_used_index_count = used_index_count;
+        m_count = count;
+        m_free_indices = std::move(free_indices);
+        m_pages = std::move(pages);
+    }
+
+    EntityTable::Slot &EntityTable::getSlot(std::size_t index)
+    {
+        auto page_i = index / ENTITY_PAGE_SIZE;
+        if (page_i >= m_pages.size())
+        {
+            m_pages.resize(page_i + 1);
+        }
+        if (!m_pages[page_i])
+        {
+            m_pages[page_i] = std::make_shared<Page>();
+        }
+        else if (m_pages[page_i].use_count() > 1) //! shared with a copy of the table
+        {
+            m_pages[page_i] = std::make_shared<Page>(*m_pages[page_i]);
+        }
+        return (*m_pages[page_i])[index % ENTITY_PAGE_SIZE];
+    }
+
+    const EntityTable::Slot *EntityTable::findSlot(EntityId id) const
+    {
+        auto index = entityIndex(id);
+        auto page_i = index / ENTITY_PAGE_SIZE;
+        if (page_i >= m_pages.size() || !m_pages[page_i])
+        {
+            return nullptr;
+        }
+        auto &slot = (*m_pages[page_i])[index % ENTITY_PAGE_SIZE];
+        return slot.alive && slot.entity.id == id ? &slot : nullptr;
+    }
+
+} // namespace ecs
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Archetype.h"
+
+#include <array>
+#include <memory>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+namespace ecs
+{
+
+#ifndef ENTITY_PAGE_SIZE
+#define ENTITY_PAGE_SIZE 4096
+#endif
+
+    //! EntityId handle: lower 32 bits are index into the entity table, upper 32 bits the generation of the index
+    constexpr std::size_t ENTITY_INDEX_BITS = 32;
+    constexpr std::size_t ENTITY_INDEX_MASK = (std::size_t{1} << ENTITY_INDEX_BITS) - 1;
+
+    constexpr std::size_t entityIndex(EntityId id)
+    {
+        return id & ENTITY_INDEX_MASK;
+    }
+
+    constexpr std::uint32_t entityGeneration(EntityId id)
+    {
+        return static_cast<std::uint32_t>(id >> ENTITY_INDEX_BITS);
+    }
+
+    constexpr EntityId makeEntityId(std::size_t index, std::uint32_t generation)
+    {
+        return (static_cast<std::size_t>(generation) << ENTITY_INDEX_BITS) | index;
+    }
+
+    struct Entity
+    {
+        EntityId id;
+        ArchetypeIndex archetype = NO_ARCHETYPE; //!< index of the archetype holding the components
+        std::uint32_t chunk = 0;                 //!< chunk of the archetype holding the component block
+        std::uint32_t row = 0;                   //!< index of the component block inside the chunk
+    };
+    static_assert(std::is_default_constructible_v<Entity>);
+
+    //! Entity storage split into pages of ENTITY_PAGE_SIZE records which get allocated on demand.
+    //! Indices of removed entities are reused with increased generation, so stale handles never alias new entities.
+    //! Copies share their pages copy-on-write, a page gets copied by the first mutable access to one of its records.
+    class EntityTable
+    {
+    public:
+        //! \returns record of a new entity with a fresh handle in its id
+        Entity &create();
+
+        //! \returns record of a new entity with the given handle, e.g. one created by another world
+        //! \throws std::logic_error if the index of the handle is used by an existing entity
+        Entity &insert(EntityId id);
+
+        //! removes the entity, its handle becomes stale
+        void destroy(EntityId id);
+
+        //! \returns true if id is a handle of an existing entity, stale handles return false
+        bool contains(EntityId id) const;
+
+        //! \throws std::out_of_range if the handle is stale
+        Entity &at(EntityId id);
+        const Entity &at(EntityId id) const;
+
+        //! \returns number of existing entities
+        std::size_t size() const;
+
+        //! writes all used pages as they are, together with the free-list
+        void save(std::ostream &os) const;
+        //! reads records written by save into this empty table, handles stay valid
+        void load(std::istream &is);
+
+    private:
+        struct Slot
+        {
+            Entity entity;
+            bool alive = false;
+        };
+        using Page = std::array<Slot, ENTITY_PAGE_SIZE>;
+
+        //! \returns slot index, its page gets allocated or unshared if needed
+        Slot &getSlot(std::size_t index);
+        const Slot *findSlot(EntityId id) const;
+
+        std::vector<std::shared_ptr<Page>> m_pages;
+        std::vector<std::size_t> m_free_indices; //!< free-list of indices of removed entities, may hold inserted ones
+        std::size_t m_used_index_count = 0;      //!< number of indices that were ever handed out
+        std::size_t m_count = 0;                 //!< number of existing entities
+    };
+
+} // namespace ecs
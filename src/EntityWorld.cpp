@@ -1,68 +1,681 @@
 #include "EntityWorld.h"
+#include "Serialization.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
 
 namespace ecs
 {
 
-    EntityWorld::EntityWorld() : m_entities() {};
+    namespace
+    {
+        std::atomic<std::uint64_t> next_world_id = 0;
+    } // namespace
+
+    EntityWorld::EntityWorld(ChunkBacking backing)
+        : m_chunk_pool(std::make_shared<ChunkPool>(COMPONENT_CHUNK_SIZE, backing)), m_id(next_world_id++) {};
+
+    EntityWorld::EntityWorld(std::shared_ptr<ChunkPool> pool)
+        : m_chunk_pool(std::move(pool)), m_id(next_world_id++) {};
 
-    bool operator<=(const ArchetypeId &first, const ArchetypeId &second)
+    void EntityWorld::onNewArchetype(ArchetypeIndex new_index)
     {
-        return (first & second) == first;
-    };
+        auto &archetype = m_archetypes[new_index];
+        archetype.setChunkPool(*m_chunk_pool);
+        archetype.registerTags(m_archetypes.signature(new_index));
+        archetype.setWorldTick(m_tick);
+        archetype.setEntityTable(m_entities, new_index);
+        for (auto &query : m_queries)
+        {
+            if (query)
+            {
+                query->addArchetype(m_archetypes.signature(new_index), archetype);
+            }
+        }
+    }
 
-    //! TODO: This is stupid AF, make somehow not retarded
-    void EntityWorld::registerToActions(ArchetypeId new_id)
+    void EntityWorld::connectArchetypes(ArchetypeIndex without_index, ArchetypeIndex with_index, int comp_id)
     {
-        //! if no such action has been registered yet, then register it!
-        if (!m_id2action_ids.contains(new_id))
+        auto &without = m_archetypes[without_index];
+        auto &with = m_archetypes[with_index];
+
+        if (with.getColumn(comp_id).offset != SHARED_COLUMN) //! target of adding a shared component depends on its value
         {
-            m_id2action_ids[new_id] = {};
+            auto &add_edge = without.m_add_edges[comp_id] = without.makeEdge(with, with_index);
+            add_edge.changed_column = with.getColumn(comp_id);
         }
 
-        //! each archetype that is contained in the new action id gets added
-        for (auto &[id, archetype] : m_archetypes)
+        auto &remove_edge = with.m_remove_edges[comp_id] = with.makeEdge(without, without_index);
+        remove_edge.changed_column = with.getColumn(comp_id);
+    }
+
+    ArchetypeIndex EntityWorld::findArchetype(const ArchetypeId &id, const std::vector<Archetype::SharedValue> &shared) const
+    {
+        return m_archetypes.find(id, shared);
+    }
+
+    void EntityWorld::setSharedValue(EntityId entity_id, Archetype::SharedValue value)
+    {
+        auto source_index = m_entities.at(entity_id).archetype;
+        auto &source = m_archetypes[source_index];
+
+        auto comp_id = value.id;
+        auto shared = source.sharedValues();
+        auto value_it = std::lower_bound(shared.begin(), shared.end(), value.id, [](auto &shared_value, int id)
+                                         { return shared_value.id < id; });
+        if (value_it != shared.end() && value_it->id == value.id)
         {
-            if (id <= new_id)
+            if (*value_it == value)
             {
-                m_id2action_ids.at(id).insert(new_id);
+                return; //! nothing changes
             }
-            if (new_id <= id)
+            *value_it = std::move(value);
+        }
+        else
+        {
+            shared.insert(value_it, std::move(value));
+        }
+
+        auto new_id = m_archetypes.signature(source_index);
+        new_id.set(comp_id);
+        auto target_index = findArchetype(new_id, shared);
+        if (target_index == NO_ARCHETYPE)
+        {
+            //! same blocks, only the shared values differ
+            target_index = m_archetypes.create(new_id, shared);
+            m_archetypes[target_index].registerComps(source.m_type_info, source.layout());
+            m_archetypes[target_index].setSharedValues(std::move(shared));
+            onNewArchetype(target_index);
+        }
+
+        auto edge_it = source.m_shared_edges.find(target_index);
+        if (edge_it == source.m_shared_edges.end())
+        {
+            edge_it = source.m_shared_edges.emplace(target_index, source.makeEdge(m_archetypes[target_index], target_index)).first;
+        }
+        source.moveEntity(entity_id, edge_it->second);
+    }
+
+    Tick EntityWorld::tick() const
+    {
+        return m_tick;
+    }
+
+    Tick EntityWorld::advanceTick()
+    {
+        return ++m_tick;
+    }
+
+    void EntityWorld::setThreadCount(std::size_t thread_count)
+    {
+        m_thread_pool = std::make_unique<ThreadPool>(thread_count);
+    }
+
+    ThreadPool &EntityWorld::getThreadPool()
+    {
+        if (!m_thread_pool)
+        {
+            m_thread_pool = std::make_unique<ThreadPool>();
+        }
+        return *m_thread_pool;
+    }
+
+    CommandBuffer &EntityWorld::commands()
+    {
+        //! a few recently used buffers per thread, found without touching shared state
+        struct CacheEntry
+        {
+            std::uint64_t world_id;
+            CommandBuffer *buffer;
+        };
+        constexpr std::size_t CACHE_SIZE = 4;
+        thread_local std::array<CacheEntry, CACHE_SIZE> cache{};
+        thread_local std::size_t cache_next = 0;
+        for (auto &entry : cache)
+        {
+            if (entry.buffer && entry.world_id == m_id) //! ids are never reused, so the buffer is still alive
             {
-                m_id2action_ids.at(new_id).insert(id);
+                return *entry.buffer;
             }
         }
 
-        for (auto &[id, other_ids] : m_id2action_ids)
+        std::lock_guard lock(m_command_buffers_mutex);
+        auto thread = std::this_thread::get_id();
+        auto buffer_it = std::ranges::find_if(m_command_buffers, [thread](auto &buffer)
+                                              { return buffer.first == thread; });
+        if (buffer_it == m_command_buffers.end())
         {
-            if (id <= new_id)
+            m_command_buffers.emplace_back(thread, std::make_unique<CommandBuffer>());
+            buffer_it = m_command_buffers.end() - 1;
+        }
+        cache[cache_next] = {.world_id = m_id, .buffer = buffer_it->second.get()};
+        cache_next = (cache_next + 1) % CACHE_SIZE;
+        return *buffer_it->second;
+    }
+
+    void EntityWorld::flush()
+    {
+        std::lock_guard lock(m_command_buffers_mutex);
+        for (auto &[thread, buffer] : m_command_buffers)
+        {
+            flush(*buffer);
+        }
+    }
+
+    void EntityWorld::flush(CommandBuffer &buffer)
+    {
+        ECS_PROFILE_SCOPE(m_profiler, Profiler::FLUSH, ProfileCategory::Structural);
+        auto commands = std::move(buffer.m_commands);
+        buffer.clear();
+
+        //! commands on one entity must keep their order, so the n-th command on an entity goes to the n-th phase
+        //! inside of a phase every entity occurs at most once and commands can be reordered freely
+        std::vector<std::vector<std::size_t>> phases;
+        std::unordered_map<EntityId, std::size_t> entity2command_count;
+        for (std::size_t command_i = 0; command_i < commands.size(); ++command_i)
+        {
+            auto &command = commands[command_i];
+            std::size_t phase_i = command.kind == CommandBuffer::Kind::AddEntity ? 0 : entity2command_count[command.entity_id]++;
+            if (phase_i >= phases.size())
             {
-                other_ids.insert(new_id);
+                phases.resize(phase_i + 1);
             }
-            else if (new_id <= id)
+            phases[phase_i].push_back(command_i);
+        }
+
+        for (auto &phase : phases)
+        {
+            flushPhase(commands, phase);
+        }
+    }
+
+    void EntityWorld::flushPhase(std::vector<CommandBuffer::Command> &commands, std::vector<std::size_t> &command_ids)
+    {
+        using Kind = CommandBuffer::Kind;
+
+        //! entities may have been removed in previous phases
+        std::erase_if(command_ids, [&](std::size_t command_i)
+                      { return commands[command_i].kind != Kind::AddEntity && !m_entities.contains(commands[command_i].entity_id); });
+
+        //! source archetypes are known only now that previous phases got applied
+        //! groups are ordered by archetype index, not address, so that flushes are deterministic
+        std::unordered_map<std::size_t, ArchetypeIndex> sources;
+        for (auto command_i : command_ids)
+        {
+            if (commands[command_i].kind != Kind::AddEntity)
             {
-                m_id2action_ids.at(new_id).insert(id);
+                sources[command_i] = m_entities.at(commands[command_i].entity_id).archetype;
             }
         }
+        auto group_key = [&](std::size_t command_i)
+        {
+            auto &command = commands[command_i];
+            return std::tuple(command.kind, command.comp_id, command.kind == Kind::AddEntity ? NO_ARCHETYPE : sources.at(command_i));
+        };
+        std::stable_sort(command_ids.begin(), command_ids.end(), [&](std::size_t a, std::size_t b)
+                         { return group_key(a) < group_key(b); });
+
+        for (std::size_t begin = 0, end = 0; begin < command_ids.size(); begin = end)
+        {
+            while (end < command_ids.size() && group_key(command_ids[end]) == group_key(command_ids[begin]))
+            {
+                end++;
+            }
+            flushGroup(commands, std::span<const std::size_t>(command_ids.data() + begin, end - begin));
+        }
     }
 
-    std::size_t EntityWorld::getNewId()
+    void EntityWorld::flushGroup(std::vector<CommandBuffer::Command> &commands, std::span<const std::size_t> command_ids)
     {
-        if (m_free_entity_ids.size() == 0)
+        using Kind = CommandBuffer::Kind;
+
+        auto &first = commands[command_ids.front()];
+        if (first.kind == Kind::AddEntity)
+        {
+            for (auto command_i : command_ids)
+            {
+                commands[command_i].create(*this);
+            }
+            return;
+        }
+        if (first.kind == Kind::RemoveEntity)
+        {
+            for (auto command_i : command_ids)
+            {
+                removeEntity(commands[command_i].entity_id);
+            }
+            return;
+        }
+        if (first.create) //! commands which cannot go along a single edge
         {
-            return m_entity_count;
+            for (auto command_i : command_ids)
+            {
+                commands[command_i].create(*this);
+            }
+            return;
         }
-        std::size_t new_id = m_free_entity_ids.back();
-        m_free_entity_ids.pop_back();
-        return new_id;
+
+        auto source_index = m_entities.at(first.entity_id).archetype;
+        auto &source = m_archetypes[source_index];
+        bool has_component = m_archetypes.signature(source_index).test(first.comp_id);
+        if (first.kind == Kind::RemoveComponent && !has_component)
+        {
+            return; //! nothing to remove
+        }
+        if (first.kind == Kind::AddComponent && has_component)
+        {
+            if (!first.construct)
+            {
+                return; //! tags have nothing to replace
+            }
+            //! no migration, the components just get replaced
+            for (auto command_i : command_ids)
+            {
+                auto &command = commands[command_i];
+                auto comp_p = source.getComponentData(source.getBlockIndex(command.entity_id), command.comp_id);
+                command.destroy(comp_p);
+                command.construct(comp_p);
+                source.markChanged(source.getBlockIndex(command.entity_id), command.comp_id);
+            }
+            return;
+        }
+
+        std::vector<EntityId> ids;
+        for (auto command_i : command_ids)
+        {
+            ids.push_back(commands[command_i].entity_id);
+        }
+
+        auto &edge = first.get_edge(*this, source_index);
+        auto first_comp_i = source.moveEntities(ids, edge);
+        for (std::size_t i = 0; i < ids.size(); ++i)
+        {
+            auto &command = commands[command_ids[i]];
+            if (command.kind == Kind::AddComponent && command.construct) //! tags have nothing to construct
+            {
+                command.construct(edge.target->getComponentData(first_comp_i + i, edge.changed_column));
+                edge.target->markAdded(first_comp_i + i, command.comp_id);
+            }
+        }
+    }
+
+    std::size_t EntityWorld::compact()
+    {
+        std::size_t reclaimed_bytes = 0;
+        for (ArchetypeIndex index = 0; index < m_archetypes.size(); ++index)
+        {
+            reclaimed_bytes += m_archetypes[index].shrink();
+        }
+        return reclaimed_bytes + m_chunk_pool->trim();
+    }
+
+    void EntityWorld::setDefaultLayout(ChunkLayout layout)
+    {
+        m_default_layout = layout;
     }
 
     void EntityWorld::removeEntity(std::size_t id)
     {
+        ECS_PROFILE_SCOPE(m_profiler, Profiler::REMOVE_ENTITY, ProfileCategory::Structural);
         auto &entity = m_entities.at(id);
-        m_archetypes.at(entity.comp_ids).removeEntity2(id);
+        m_archetypes[entity.archetype].removeEntity2(id);
+
+        m_entities.destroy(id);
+        if (m_deltas_enabled)
+        {
+            m_removals.emplace_back(m_tick, id);
+        }
+    }
+
+    void EntityWorld::enableDeltas()
+    {
+        m_deltas_enabled = true;
+    }
+
+    void EntityWorld::discardRemovalsBefore(Tick tick)
+    {
+        auto end = std::ranges::lower_bound(m_removals, tick, {}, &std::pair<Tick, EntityId>::first);
+        m_removals.erase(m_removals.begin(), end);
+    }
+
+    std::size_t EntityWorld::removalLogSize() const
+    {
+        return m_removals.size();
+    }
+
+    //! "ECSW" followed by the format version
+    constexpr std::uint32_t SNAPSHOT_MAGIC = 0x57534345;
+    constexpr std::uint32_t SNAPSHOT_VERSION = 4;
+    //! "ECSD" followed by the format version
+    constexpr std::uint32_t DELTA_MAGIC = 0x44534345;
+    constexpr std::uint32_t DELTA_VERSION = 2;
+
+    namespace
+    {
+        //! everything needed to find or recreate an archetype in another world
+        //! sizes and alignments of the components are stored too, component bytes are only valid for the same layout
+        struct ArchetypeHeader
+        {
+            ArchetypeId signature;
+            ChunkLayout layout;
+            std::vector<CompTypeInfo> type_info;
+            std::vector<Archetype::SharedValue> shared;
+        };
+
+        void writeArchetypeHeader(std::ostream &os, const ArchetypeId &signature, const Archetype &archetype)
+        {
+            auto comp_ids = signature.ids();
+            writeRaw<std::uint32_t>(os, comp_ids.size());
+            writeBytes(os, std::as_bytes(comp_ids));
+            writeRaw(os, static_cast<std::uint8_t>(archetype.layout()));
+
+            writeRaw<std::uint32_t>(os, archetype.m_type_info.size());
+            for (auto &type : archetype.m_type_info)
+            {
+                writeRaw(os, type.id);
+                writeRaw<std::uint64_t>(os, type.size);
+                writeRaw<std::uint64_t>(os, type.align);
+            }
+            writeRaw<std::uint32_t>(os, archetype.sharedValues().size());
+            for (auto &shared : archetype.sharedValues())
+            {
+                writeRaw(os, shared.id);
+                ComponentRegistry::at(shared.id).write(os, shared.value.get());
+            }
+        }
+
+        ArchetypeHeader readArchetypeHeader(std::istream &is)
+        {
+            ArchetypeHeader header;
+            for (auto comp_id : readVector<ComponentIndex>(is, readRaw<std::uint32_t>(is)))
+            {
+                header.signature.set(comp_id);
+            }
+            auto layout = readRaw<std::uint8_t>(is);
+            if (layout != static_cast<std::uint8_t>(ChunkLayout::AoS) && layout != static_cast<std::uint8_t>(ChunkLayout::SoA))
+            {
+                throw std::runtime_error("unknown chunk layout " + std::to_string(layout));
+            }
+            header.layout = static_cast<ChunkLayout>(layout);
+
+            auto read_comp_id = [&]
+            {
+                auto comp_id = readRaw<int>(is);
+                if (comp_id < 0 || !header.signature.test(comp_id))
+                {
+                    throw std::runtime_error("component " + std::to_string(comp_id) + " is not in the signature of its archetype");
+                }
+                return comp_id;
+            };
+            auto type_count = readRaw<std::uint32_t>(is);
+            for (std::uint32_t type_i = 0; type_i < type_count; ++type_i)
+            {
+                auto comp_id = read_comp_id();
+                const auto &type_info = ComponentRegistry::at(comp_id).type_info;
+                auto size = readRaw<std::uint64_t>(is);
+                auto align = readRaw<std::uint64_t>(is);
+                if (size != type_info.size || align != type_info.align)
+                {
+                    throw std::runtime_error("component " + std::to_string(comp_id) + " has a different size or alignment than when it was saved");
+                }
+                header.type_info.push_back(type_info);
+            }
+            auto shared_count = readRaw<std::uint32_t>(is);
+            for (std::uint32_t shared_i = 0; shared_i < shared_count; ++shared_i)
+            {
+                header.shared.push_back(ComponentRegistry::at(read_comp_id()).read_shared(is));
+            }
+            return header;
+        }
+    } // namespace
+
+    void EntityWorld::save(std::ostream &os) const
+    {
+        writeRaw(os, SNAPSHOT_MAGIC);
+        writeRaw(os, SNAPSHOT_VERSION);
+        writeRaw<std::uint64_t>(os, COMPONENT_CHUNK_SIZE);
+        writeRaw(os, m_tick);
+        m_entities.save(os);
+
+        //! archetypes keep their indices, so the entity records need not change
+        writeRaw<std::uint64_t>(os, m_archetypes.size());
+        for (ArchetypeIndex index = 0; index < m_archetypes.size(); ++index)
+        {
+            writeArchetypeHeader(os, m_archetypes.signature(index), m_archetypes[index]);
+            m_archetypes[index].save(os);
+        }
+        if (!os)
+        {
+            throw std::runtime_error("writing world snapshot failed");
+        }
+    }
+
+    void EntityWorld::load(std::istream &is)
+    {
+        if (m_archetypes.size() > 0 || m_entities.size() > 0)
+        {
+            throw std::logic_error("world snapshots can be loaded only into an empty world");
+        }
+        if (readRaw<std::uint32_t>(is) != SNAPSHOT_MAGIC || readRaw<std::uint32_t>(is) != SNAPSHOT_VERSION)
+        {
+            throw std::runtime_error("not a world snapshot or of unsupported version");
+        }
+        if (readRaw<std::uint64_t>(is) != COMPONENT_CHUNK_SIZE)
+        {
+            throw std::runtime_error("world snapshot was written with a different chunk size");
+        }
+        m_tick = readRaw<Tick>(is);
+        m_entities.load(is);
+
+        std::size_t loaded_count = 0;
+        auto archetype_count = readRaw<std::uint64_t>(is);
+        for (std::uint64_t archetype_i = 0; archetype_i < archetype_count; ++archetype_i)
+        {
+            auto header = readArchetypeHeader(is);
+            auto index = m_archetypes.create(header.signature, header.shared);
+            auto &archetype = m_archetypes[index];
+            archetype.registerComps(std::move(header.type_info), header.layout); //! same order as saved -> same layout
+            archetype.setSharedValues(std::move(header.shared));
+            onNewArchetype(index);
+            archetype.load(is);
+            loaded_count += archetype.entityCount();
+        }
+        //! every block matches the record of its entity, so no entity is stored twice, but some may be missing
+        if (loaded_count != m_entities.size())
+        {
+            throw std::runtime_error("world snapshot has entities without components");
+        }
+    }
+
+    void EntityWorld::saveDelta(std::ostream &os, Tick since) const
+    {
+        if (!m_deltas_enabled)
+        {
+            throw std::logic_error("deltas need enableDeltas, which starts logging removals");
+        }
+        writeRaw(os, DELTA_MAGIC);
+        writeRaw(os, DELTA_VERSION);
+        writeRaw(os, m_tick);
 
-        m_free_entity_ids.push_back(id);
-        m_entity_count--;
+        //! removals are logged in the order of ticks
+        auto removals_begin = std::ranges::lower_bound(m_removals, since, {}, &std::pair<Tick, EntityId>::first);
+        writeRaw<std::uint64_t>(os, m_removals.end() - removals_begin);
+        for (auto it = removals_begin; it != m_removals.end(); ++it)
+        {
+            writeRaw(os, it->second);
+        }
+
+        std::vector<std::pair<ArchetypeIndex, std::vector<std::size_t>>> changed_chunks;
+        for (ArchetypeIndex index = 0; index < m_archetypes.size(); ++index)
+        {
+            std::vector<std::size_t> chunks;
+            for (std::size_t chunk_i = 0; chunk_i < m_archetypes[index].usedChunkCount(); ++chunk_i)
+            {
+                if (m_archetypes[index].chunkChanged(chunk_i, since))
+                {
+                    chunks.push_back(chunk_i);
+                }
+            }
+            if (!chunks.empty())
+            {
+                changed_chunks.emplace_back(index, std::move(chunks));
+            }
+        }
+
+        //! archetypes are identified by their components and shared values, indices differ between worlds
+        writeRaw<std::uint64_t>(os, changed_chunks.size());
+        for (auto &[index, chunks] : changed_chunks)
+        {
+            auto &archetype = m_archetypes[index];
+            writeArchetypeHeader(os, m_archetypes.signature(index), archetype);
+            writeRaw<std::uint32_t>(os, chunks.size());
+            for (auto chunk_i : chunks)
+            {
+                auto ids = archetype.chunkEntities(chunk_i);
+                writeRaw<std::uint64_t>(os, ids.size());
+                writeBytes(os, std::as_bytes(ids));
+                archetype.saveChunkColumns(os, chunk_i, since);
+            }
+        }
+        if (!os)
+        {
+            throw std::runtime_error("writing world delta failed");
+        }
+    }
+
+    void EntityWorld::applyDelta(std::istream &is)
+    {
+        if (readRaw<std::uint32_t>(is) != DELTA_MAGIC || readRaw<std::uint32_t>(is) != DELTA_VERSION)
+        {
+            throw std::runtime_error("not a world delta or of unsupported version");
+        }
+        m_tick = readRaw<Tick>(is);
+
+        //! removals go first, indices of removed entities may have been reused by created ones
+        auto removal_count = readRaw<std::uint64_t>(is);
+        for (std::uint64_t removal_i = 0; removal_i < removal_count; ++removal_i)
+        {
+            auto id = readRaw<EntityId>(is);
+            if (m_entities.contains(id)) //! entities created and removed within the delta never got here
+            {
+                removeEntity(id);
+            }
+        }
+
+        auto archetype_count = readRaw<std::uint64_t>(is);
+        for (std::uint64_t archetype_i = 0; archetype_i < archetype_count; ++archetype_i)
+        {
+            auto header = readArchetypeHeader(is);
+            auto index = findArchetype(header.signature, header.shared);
+            if (index == NO_ARCHETYPE)
+            {
+                index = m_archetypes.create(header.signature, header.shared);
+                m_archetypes[index].registerComps(std::move(header.type_info), header.layout);
+                m_archetypes[index].setSharedValues(std::move(header.shared));
+                onNewArchetype(index);
+            }
+            auto &archetype = m_archetypes[index];
+
+            auto chunk_count = readRaw<std::uint32_t>(is);
+            for (std::uint32_t chunk_i = 0; chunk_i < chunk_count; ++chunk_i)
+            {
+                auto ids = readVector<EntityId>(is, readRaw<std::uint64_t>(is));
+
+                //! entities new to the archetype get an unconstructed block, their components follow in full
+                std::vector<std::size_t> comp_indices;
+                std::vector<bool> fresh;
+                for (auto id : ids)
+                {
+                    if (m_entities.contains(id) && m_entities.at(id).archetype == index)
+                    {
+                        comp_indices.push_back(archetype.getBlockIndex(id));
+                        fresh.push_back(false);
+                        continue;
+                    }
+                    if (m_entities.contains(id)) //! migrated, its components are sent again
+                    {
+                        m_archetypes[m_entities.at(id).archetype].removeEntity2(id);
+                    }
+                    else
+                    {
+                        m_entities.insert(id);
+                    }
+                    comp_indices.push_back(archetype.allocateNewEntity(id));
+                    fresh.push_back(true);
+                }
+                archetype.loadChunkColumns(is, comp_indices, fresh);
+            }
+        }
+    }
+
+    std::unique_ptr<EntityWorld> EntityWorld::fork() const
+    {
+        std::unique_ptr<EntityWorld> forked(new EntityWorld(m_chunk_pool));
+        forked->m_tick = m_tick;
+        forked->m_default_layout = m_default_layout;
+        forked->m_deltas_enabled = m_deltas_enabled;
+        forked->m_removals = m_removals;
+        forked->m_entities = m_entities; //! pages are shared copy-on-write too
+
+        //! archetypes keep their indices, so the entity records need not change
+        for (ArchetypeIndex index = 0; index < m_archetypes.size(); ++index)
+        {
+            auto &source = m_archetypes[index];
+            auto forked_index = forked->m_archetypes.create(m_archetypes.signature(index), source.sharedValues());
+            auto &archetype = forked->m_archetypes[forked_index];
+            archetype.registerComps(source.m_type_info, source.layout());
+            archetype.setSharedValues(source.sharedValues());
+            forked->onNewArchetype(forked_index);
+            archetype.forkFrom(source);
+        }
+        return forked;
+    }
+
+    void EntityWorld::unshareChunks(const ArchetypeId &comp_ids)
+    {
+        for (ArchetypeIndex index = 0; index < m_archetypes.size(); ++index)
+        {
+            if (m_archetypes.signature(index).intersects(comp_ids))
+            {
+                m_archetypes[index].unshareChunks();
+            }
+        }
+    }
+
+    bool EntityWorld::contains(EntityId entity_id) const
+    {
+        return m_entities.contains(entity_id);
+    }
+
+    std::size_t EntityWorld::entityCount() const
+    {
+        return m_entities.size();
+    }
+
+#ifdef ECS_PROFILING
+    Profiler &EntityWorld::profiler()
+    {
+        return m_profiler;
+    }
+
+    std::uint32_t EntityWorld::queryProfileName(const ArchetypeId &required, const ArchetypeId &excluded)
+    {
+        std::string name = "query(";
+        for (auto comp_id : required.ids())
+        {
+            name += std::to_string(comp_id) + ",";
+        }
+        for (auto comp_id : excluded.ids())
+        {
+            name += "!" + std::to_string(comp_id) + ",";
+        }
+        if (name.back() == ',')
+        {
+            name.pop_back();
+        }
+        return m_profiler.nameId(name + ")");
     }
+#endif
 
-} // namespace ecs
\ No newline at end of file
+} // namespace ecs
@@ -1,40 +1,24 @@
 #pragma once
 
 #include "Archetype.h"
+#include "ArchetypeTable.h"
+#include "Query.h"
+#include "EntityTable.h"
+#include "CommandBuffer.h"
 
 #include <iostream>
-#include <bitset>
 #include <cstring>
 #include <array>
+#include <thread>
+#include <mutex>
 
 namespace ecs
 {
 
-#ifndef MAX_ENTITY_COUNT
-    constexpr int MAX_ENTITY_COUNT = 20000;
-#endif
-
-#ifndef MAX_COMPONENT_COUNT
-    constexpr int MAX_COMPONENT_COUNT = 64;
-#endif
-
-    using ArchetypeId = std::bitset<MAX_COMPONENT_COUNT>;
-
-    struct Entity
-    {
-        EntityId id;
-        ArchetypeId comp_ids;
-    };
-    static_assert(std::is_default_constructible_v<Entity>);
-
-    //! this operator means: first IS CONTAINED in second
-    //! for instance Archetype: AB IS CONTAINED in ABCD and ABD but not in AD
-    //! when this is true then action with ArchetypeId second should be called when ArchetypeId first is called
-    bool operator<=(const ArchetypeId &first, const ArchetypeId &second);
-
     struct EntityWorld
     {
-        EntityWorld();
+        //! chunks of all archetypes are taken from a pool backed by backing
+        explicit EntityWorld(ChunkBacking backing = ChunkBacking::Heap);
 
         template <Component... Comps>
         ArchetypeId getId() const;
@@ -42,206 +26,554 @@ namespace ecs
         template <Component Comp>
         bool has(EntityId entity_id) const;
 
+        //! \returns false for handles of removed entities
+        bool contains(EntityId entity_id) const;
+
+        //! \returns number of existing entities
+        std::size_t entityCount() const;
+
         void removeEntity(std::size_t id);
 
-        template <typename Callable>
+        //! calls callable on every entity having the components of its parameters
+        //! parameters: Comp& or const Comp& (read only, does not count as a write), Comp* for optional components (nullptr if missing)
+        //! Filters... may exclude archetypes by Without<Comp>, e.g. forEach<Without<CompC>>([](CompA& a, CompB* b){...})
+        template <class... Filters, typename Callable>
         void forEach(Callable &&callable);
 
+        //! same as forEach but visits only chunks passing all of Filters... (Changed<Comp>, Added<Comp>) since the tick since
+        //! e.g. forEach<Changed<CompA>>(callable, last_run) with last_run = advanceTick() after the previous run
+        template <class... Filters, typename Callable>
+        void forEach(Callable &&callable, Tick since);
+
+        //! calls callable(std::span<const EntityId> ids, ColumnView<Comps>... columns) once per chunk
+        //! of every archetype containing Comps..., columns hold ids.size() components each
+        //! shared components are taken as const Comp& parameters, their value is the same for the whole chunk
+        template <class... Filters, typename Callable>
+        void forEachChunk(Callable &&callable);
+
+        //! forEachChunk visiting only chunks passing all of Filters... since the tick since
+        template <class... Filters, typename Callable>
+        void forEachChunk(Callable &&callable, Tick since);
+
+        //! same as forEach but chunks of matched archetypes are processed by the thread pool
+        //! in tasks of grain_size chunks, callable must be safe to call concurrently
+        template <typename Callable>
+        void parallelForEach(Callable &&callable, std::size_t grain_size = 1);
+
+        //! \returns current world tick, writes into components get stamped by it
+        //! mutable access (Comp& parameters, get) counts as a write, const Comp& parameters do not
+        Tick tick() const;
+
+        //! starts a new tick, so that everything written from now on is newer than what was written before
+        //! \returns the new tick
+        Tick advanceTick();
+
+        //! replaces the thread pool used by parallelForEach by one with thread_count workers
+        void setThreadCount(std::size_t thread_count);
+
+        ThreadPool &getThreadPool();
+
+        //! \returns cached query matching all archetypes containing the required Terms... and none of the Without ones
+        //! e.g. query<CompA, Optional<CompB>, Without<CompC>>(), see QueryOf
+        //! the query is created on first use and kept up to date when new archetypes appear
+        //! creation must not happen alongside other accesses of the world, e.g. by systems of a SystemScheduler
+        template <class... Terms>
+        QueryOf<Terms...> &query();
+
         template <Component Comp>
         Comp &get(EntityId entity_id);
 
         template <Component... Comps>
         Entity addEntity(Comps&&... comps);
 
+        //! creates count entities with components copied from prototypes
+        //! ids and chunk space are reserved up front and components get constructed column by column
+        //! \returns ids of the created entities
+        template <Component... Comps>
+        std::vector<EntityId> addEntities(std::size_t count, const Comps &...prototypes);
+
+        //! creates count entities like above, then calls init(i, comps...) with the components of the i-th one
+        //! to give them their own values, e.g. addEntities(n, [](std::size_t i, CompA& a){ a.a = i; }, CompA{})
+        //! tags and shared components are passed as const references, their values are the ones of the prototypes
+        template <Component... Comps, typename Init>
+            requires std::invocable<Init &, std::size_t, InitParam<Comps>...>
+        std::vector<EntityId> addEntities(std::size_t count, Init &&init, const Comps &...prototypes);
+
+        //! adding a shared component which the entity has already changes its value, both move the entity
+        //! into the archetype with the new value
         template <Component Comp>
         void addComponent(EntityId entity_id, Comp comp);
 
         template <Component Comp>
         void removeComponent(EntityId entity_id);
 
+        //! \returns command buffer of the calling thread, its commands get applied by flush()
+        //! threads find their buffer in a thread local cache, so recording from inside of parallelForEach does not lock
+        CommandBuffer &commands();
+
+        //! applies commands recorded in the buffers of all threads, buffers in the order in which their threads first
+        //! called commands()
+        //! must not be called while iterating
+        void flush();
+
+        //! applies commands recorded in buffer and clears it
+        //! commands on one entity are applied in the recorded order, otherwise they get grouped by kind,
+        //! component and source archetype so that migrations along the same edge run as one bulk move
+        //! commands on entities which do not exist anymore are skipped
+        void flush(CommandBuffer &buffer);
+
+        //! releases unused chunks of all archetypes, shrinks their bookkeeping and returns cached chunks of the pool
+        //! to the system (archetypes are always densely packed, so no blocks need to be moved)
+        //! \returns number of bytes reclaimed
+        std::size_t compact();
+
+        //! sets the layout of archetypes which get created from now on
+        void setDefaultLayout(ChunkLayout layout);
+
+        //! creates the archetype of Comps... with the given chunk layout, the archetype must not exist yet
+        template <Component... Comps>
+        void setLayout(ChunkLayout layout);
+
+        //! writes a binary snapshot of all entities, archetypes and the tick into os
+        //! all component types need to be in the ComponentRegistry (see Serialization.h) for the snapshot to be loadable
+        void save(std::ostream &os) const;
+
+        //! restores a snapshot written by save into this world, which must not have any archetypes yet
+        //! entity handles stay valid, archetypes are rebuilt chunk by chunk without adding entities one by one
+        //! \throws std::runtime_error on malformed input, the world has to be discarded then
+        //! \throws std::logic_error if the world is not empty
+        void load(std::istream &is);
+
+        //! starts logging removed entities for saveDelta, worlds which never send deltas keep no log
+        //! deltas since a tick before this call miss the removals in between
+        void enableDeltas();
+
+        //! writes the changes since the tick since into os: handles of removed entities, then ids and written columns
+        //! of every chunk which got written or had entities moved in (created or migrated by adding/removing components)
+        //! deltas are self-delimiting, consecutive ones can go through one stream (a pipe, a file, a socket buffer)
+        //! e.g. world.saveDelta(os, since); since = world.advanceTick(); so that later writes fall into the next delta
+        //! the ComponentRegistry has to know non trivially copyable components and all shared ones, as for save
+        //! \throws std::logic_error if enableDeltas was not called
+        void saveDelta(std::ostream &os, Tick since) const;
+
+        //! applies a delta written by saveDelta of another world, on top of its snapshot or previous deltas
+        //! entities keep their handles, the tick of this world is set to the one of the writer
+        //! \throws std::runtime_error on malformed input, the world has to be discarded then
+        //! \throws std::logic_error if the delta does not continue what was applied before (an entity index is taken)
+        void applyDelta(std::istream &is);
+
+        //! forgets about entities removed before tick, deltas since an earlier tick would miss their removal
+        //! the log grows with every removal until then, so call it with the oldest tick deltas are still saved since
+        void discardRemovalsBefore(Tick tick);
+
+        //! \returns number of removals logged for deltas
+        std::size_t removalLogSize() const;
+
+        //! \returns copy of this world which shares chunks with it copy-on-write, e.g. for rollback or speculative simulation
+        //! a shared chunk gets copied by the world which first accesses it mutably (non-const get and forEach parameters,
+        //! structural changes), read only access keeps it shared, so forking costs little more than the entity records
+        //! archetypes with non trivially copyable components are copied right away by their copy constructors
+        //! both worlds take chunks from the same thread safe pool and can be used from different threads afterwards
+        //! pending commands, cached queries and the thread pool are not taken over
+        std::unique_ptr<EntityWorld> fork() const;
+
+        //! copies the chunks still shared with forks of all archetypes containing any of comp_ids
+        //! after that, writes of those components do not swap chunks under concurrent readers of the other components
+        void unshareChunks(const ArchetypeId &comp_ids);
+
+#ifdef ECS_PROFILING
+        //! events of queries, structural changes and scheduled systems of this world, forks start with an empty one
+        Profiler &profiler();
+#endif
+
     private:
+        friend class CommandBuffer;
+        friend class SystemScheduler;
+
+        //! world taking chunks from the pool of the world it is forked from
+        explicit EntityWorld(std::shared_ptr<ChunkPool> pool);
+
+        //! applies commands with indices command_ids, no entity occurs twice among them
+        void flushPhase(std::vector<CommandBuffer::Command> &commands, std::vector<std::size_t> &command_ids);
+        //! applies commands with the same kind, component id and source archetype
+        void flushGroup(std::vector<CommandBuffer::Command> &commands, std::span<const std::size_t> command_ids);
+
+        template <class... Filters, typename C, typename R, class... Comps>
+        void forEachHelper(C &&callable, Tick since, const std::function<R(Comps...)> &);
+        template <class... Filters, typename C, typename R, class... Params>
+        void forEachChunkHelper(C &&callable, Tick since, const std::function<R(std::span<const EntityId>, Params...)> &);
         template <typename C, typename R, class... Comps>
-        void forEachHelper(C &&callable, const std::function<R(Comps...)> &);
+        void parallelForEachHelper(C &&callable, std::size_t grain_size, const std::function<R(Comps...)> &);
+
+        //! \returns index of the archetype made of Comps... with the given values of shared components (sorted by id)
+        //! it gets created if it does not exist yet
+        template <Component... Comps>
+        ArchetypeIndex getArchetype(const std::vector<Archetype::SharedValue> &shared = {});
+
+        //! \returns index of the archetype with signature id and the given shared values or NO_ARCHETYPE
+        ArchetypeIndex findArchetype(const ArchetypeId &id, const std::vector<Archetype::SharedValue> &shared) const;
 
-        //! TODO: This is stupid AF, make somehow not retarded
-        void registerToActions(ArchetypeId new_id);
+        //! moves the entity into the archetype with shared component value.id set to value
+        void setSharedValue(EntityId entity_id, Archetype::SharedValue value);
 
-        std::size_t getNewId();
+        template <Component Comp>
+        Archetype::Edge &getAddEdge(ArchetypeIndex index);
+        template <Component Comp>
+        Archetype::Edge &getRemoveEdge(ArchetypeIndex index);
+
+        //! caches edges between archetype without and with component comp_id in both directions
+        void connectArchetypes(ArchetypeIndex without, ArchetypeIndex with, int comp_id);
+
+        //! finishes creation of newly registered archetype new_index: gives it the chunk pool and adds it to matching queries
+        void onNewArchetype(ArchetypeIndex new_index);
+
+#ifdef ECS_PROFILING
+        //! \returns profiler name of the query with the given terms, e.g. "query(1,2,!3)"
+        std::uint32_t queryProfileName(const ArchetypeId &required, const ArchetypeId &excluded);
+#endif
+
+        std::shared_ptr<ChunkPool> m_chunk_pool; //!< shared by all archetypes and forks, declared first so that it outlives them
 
     public:
-        std::unordered_map<ArchetypeId, Archetype> m_archetypes; //!< holds all archetype, which hold all components
+        ArchetypeTable m_archetypes; //!< holds all archetype, which hold all components
     private:
-        //! remembers which action get called for each ID.
-        //! For example: If we have archetypes A, AB, and ABC and action AB, then AB and ABC should be called
-        std::unordered_map<ArchetypeId, std::unordered_set<ArchetypeId>> m_id2action_ids;
+        std::vector<std::unique_ptr<QueryBase>> m_queries; //!< cached queries indexed by QueryIdGenerator ids
+        bool m_queries_frozen = false;                     //!< set while concurrent systems run, creating queries would race
+
+        EntityTable m_entities; //!< entity storage
+
+        ChunkLayout m_default_layout = ChunkLayout::AoS; //!< layout of newly created archetypes
+
+        Tick m_tick = 0; //!< stamped into chunks on writes, archetypes keep a pointer to it
+        bool m_deltas_enabled = false;                     //!< removals get logged, see enableDeltas
+        std::vector<std::pair<Tick, EntityId>> m_removals; //!< removed entities with the tick of their removal, for deltas
 
-        std::array<Entity, MAX_ENTITY_COUNT> m_entities; //!< entity storage
-        std::size_t m_entity_count = 0;                  //!< number of existing entities
-        std::vector<EntityId> m_free_entity_ids;         //!< entity id free-list
+        std::unique_ptr<ThreadPool> m_thread_pool; //!< created on first use
+
+        std::uint64_t m_id;                 //!< unique among all worlds ever created, threads cache their command buffers by it
+        std::mutex m_command_buffers_mutex; //!< guards m_command_buffers
+        std::vector<std::pair<std::thread::id, std::unique_ptr<CommandBuffer>>> m_command_buffers; //!< one per thread, in the order of their first use
+
+#ifdef ECS_PROFILING
+        Profiler m_profiler;
+#endif
     };
 
     template <Component... Comps>
     ArchetypeId EntityWorld::getId() const
     {
-        ArchetypeId id;
-        ((id[Comps::id] = true), ...);
-        return id;
+        return archetypeIdOf<Comps...>();
     }
 
     template <Component Comp>
     bool EntityWorld::has(EntityId entity_id) const
     {
-        return m_entities.at(entity_id).comp_ids[Comp::id];
+        return m_archetypes.signature(m_entities.at(entity_id).archetype).test(Comp::id);
     }
 
-    template <typename C, typename R, class... Comps>
-    void EntityWorld::forEachHelper(C &&callable, const std::function<R(Comps...)> &)
+    template <class... Filters, typename C, typename R, class... Comps>
+    void EntityWorld::forEachHelper(C &&callable, Tick since, const std::function<R(Comps...)> &)
     {
 
         static_assert(std::is_same_v<void, R>);
 
-        auto id = getId<std::remove_reference_t<Comps>...>();
-        //! if the action is new we need to register it
-        // if (!m_id2action_ids.contains(id))
+        auto &query = this->query<typename ParamTerm<Comps>::type..., Filters...>();
+        ECS_PROFILE_NAMED_SCOPE(profile_scope, m_profiler, query.profile_name, ProfileCategory::Query);
+        [[maybe_unused]] QueryStats stats;
+        if constexpr (sizeof...(Filters) == 0)
+        {
+            stats = query.forEach(std::forward<C>(callable));
+        }
+        else
         {
-            registerToActions(id);
+            stats = query.template forEach<Filters...>(std::forward<C>(callable), since);
         }
+        ECS_PROFILE_STATS(profile_scope, stats);
+    }
 
-        //! go through all archetypes whose id fully contains actions id
-        //! TODO: each action should probably be stored and it should hold it's corresponding ids
-        for (auto &corresponding_id : m_id2action_ids.at(id))
+    template <class... Filters, typename Callable>
+    void EntityWorld::forEach(Callable &&callable)
+    {
+        using std_function_type = decltype(std::function{std::forward<Callable>(callable)});
+        forEachHelper<Filters...>(std::forward<Callable>(callable), 0, std_function_type{});
+    }
+
+    template <class... Filters, typename Callable>
+    void EntityWorld::forEach(Callable &&callable, Tick since)
+    {
+        using std_function_type = decltype(std::function{std::forward<Callable>(callable)});
+        forEachHelper<Filters...>(std::forward<Callable>(callable), since, std_function_type{});
+    }
+
+    template <class... Filters, typename C, typename R, class... Params>
+    void EntityWorld::forEachChunkHelper(C &&callable, Tick since, const std::function<R(std::span<const EntityId>, Params...)> &)
+    {
+        static_assert(std::is_same_v<void, R>);
+
+        auto &query = this->query<typename ChunkParamTerm<Params>::type..., Filters...>();
+        ECS_PROFILE_NAMED_SCOPE(profile_scope, m_profiler, query.profile_name, ProfileCategory::Query);
+        [[maybe_unused]] QueryStats stats;
+        if constexpr (sizeof...(Filters) == 0)
         {
-            if (m_archetypes.contains(corresponding_id))
-            {
-                m_archetypes.at(corresponding_id).template forEach2<C, std::remove_reference_t<Comps>...>(std::forward<C>(callable));
-            }
+            stats = query.forEachChunk(std::forward<C>(callable));
+        }
+        else
+        {
+            stats = query.template forEachChunk<Filters...>(std::forward<C>(callable), since);
         }
+        ECS_PROFILE_STATS(profile_scope, stats);
+    }
+
+    template <class... Filters, typename Callable>
+    void EntityWorld::forEachChunk(Callable &&callable)
+    {
+        using std_function_type = decltype(std::function{std::forward<Callable>(callable)});
+        forEachChunkHelper<Filters...>(std::forward<Callable>(callable), 0, std_function_type{});
+    }
+
+    template <class... Filters, typename Callable>
+    void EntityWorld::forEachChunk(Callable &&callable, Tick since)
+    {
+        using std_function_type = decltype(std::function{std::forward<Callable>(callable)});
+        forEachChunkHelper<Filters...>(std::forward<Callable>(callable), since, std_function_type{});
+    }
+
+    template <typename C, typename R, class... Comps>
+    void EntityWorld::parallelForEachHelper(C &&callable, std::size_t grain_size, const std::function<R(Comps...)> &)
+    {
+        static_assert(std::is_same_v<void, R>);
+
+        auto &query = this->query<typename ParamTerm<Comps>::type...>();
+        ECS_PROFILE_NAMED_SCOPE(profile_scope, m_profiler, query.profile_name, ProfileCategory::Query);
+        [[maybe_unused]] auto stats = query.parallelForEach(getThreadPool(), std::forward<C>(callable), grain_size);
+        ECS_PROFILE_STATS(profile_scope, stats);
     }
 
     template <typename Callable>
-    void EntityWorld::forEach(Callable &&callable)
+    void EntityWorld::parallelForEach(Callable &&callable, std::size_t grain_size)
     {
         using std_function_type = decltype(std::function{std::forward<Callable>(callable)});
-        forEachHelper(std::forward<Callable>(callable), std_function_type{});
+        parallelForEachHelper(std::forward<Callable>(callable), grain_size, std_function_type{});
+    }
+
+    template <class... Terms>
+    QueryOf<Terms...> &EntityWorld::query()
+    {
+        auto query_id = QueryIdGenerator::getId<std::tuple<Terms...>>();
+        if (query_id >= m_queries.size())
+        {
+            assert(!m_queries_frozen && "queries of scheduled systems have to be created when they get registered");
+            m_queries.resize(query_id + 1);
+        }
+
+        auto &query = m_queries[query_id];
+        if (!query) //! new query has to go through all existing archetypes once
+        {
+            assert(!m_queries_frozen && "queries of scheduled systems have to be created when they get registered");
+            ArchetypeId required;
+            ArchetypeId excluded;
+            (addTermIds<Terms>(required, excluded), ...);
+            query = std::make_unique<QueryOf<Terms...>>(required, excluded);
+#ifdef ECS_PROFILING
+            query->profile_name = queryProfileName(required, excluded);
+#endif
+            for (ArchetypeIndex index = 0; index < m_archetypes.size(); ++index)
+            {
+                query->addArchetype(m_archetypes.signature(index), m_archetypes[index]);
+            }
+        }
+        return static_cast<QueryOf<Terms...> &>(*query);
     }
 
     template <Component Comp>
     Comp &EntityWorld::get(EntityId entity_id)
     {
-        return m_archetypes.at(m_entities.at(entity_id).comp_ids).get2<Comp>(entity_id);
+        auto &entity = std::as_const(m_entities).at(entity_id); //! the record does not change
+        return m_archetypes[entity.archetype].getAt<Comp>(entity.chunk, entity.row);
     }
 
     template <Component... Comps>
-    Entity EntityWorld::addEntity(Comps&&... comps)
+    ArchetypeIndex EntityWorld::getArchetype(const std::vector<Archetype::SharedValue> &shared)
     {
-        Entity new_entity;
-        new_entity.id = getNewId();
-        m_entity_count++;
-        new_entity.comp_ids = getId<Comps...>();
-
-        if (!m_archetypes.contains(new_entity.comp_ids))
+        auto id = getId<Comps...>();
+        auto index = findArchetype(id, shared);
+        if (index == NO_ARCHETYPE)
         {
-            m_archetypes[new_entity.comp_ids].registerComps<Comps...>();
-            registerToActions(new_entity.comp_ids);
+            index = m_archetypes.create(id, shared);
+            m_archetypes[index].template registerComps<std::remove_cv_t<Comps>...>(m_default_layout);
+            m_archetypes[index].setSharedValues(shared);
+            onNewArchetype(index);
         }
+        return index;
+    }
 
-        m_archetypes.at(new_entity.comp_ids).addEntity2(new_entity.id, std::forward<Comps>(comps)...);
+    template <Component... Comps>
+    Entity EntityWorld::addEntity(Comps&&... comps)
+    {
+        auto index = getArchetype<Comps...>(sharedValuesOf(comps...));
+        Entity &new_entity = m_entities.create();
 
-        m_entities.at(new_entity.id) = new_entity;
+        //! the archetype fills in the location of the entity
+        m_archetypes[index].addEntity2(new_entity.id, std::forward<Comps>(comps)...);
 
         return new_entity;
     };
 
-    template <Component Comp>
-    void EntityWorld::addComponent(EntityId entity_id, Comp comp)
+    template <Component... Comps>
+    std::vector<EntityId> EntityWorld::addEntities(std::size_t count, const Comps &...prototypes)
     {
-        auto &entity = m_entities.at(entity_id);
-        auto &archetype = m_archetypes.at(entity.comp_ids);
+        auto index = getArchetype<Comps...>(sharedValuesOf(prototypes...));
 
-        //! remove the entity from it's current archetype and add the component to its new data_block
-        auto component_data = archetype.removeEntityAndGetData(entity_id);
+        std::vector<EntityId> ids(count);
+        for (auto &id : ids)
+        {
+            id = m_entities.create().id;
+        }
 
-        //! set the right bit in ArchetypeId;
-        entity.comp_ids[Comp::id] = true;
+        m_archetypes[index].addEntities(std::span<const EntityId>(ids), prototypes...);
+        return ids;
+    }
 
-        if (!m_archetypes.contains(entity.comp_ids)) //! create the archetype if it is new
-        {
-            //! correct type info
-            auto comp_type_info = archetype.m_type_info;
-            CompTypeInfo new_info = CompTypeInfo{Comp{}};
+    template <Component... Comps, typename Init>
+        requires std::invocable<Init &, std::size_t, InitParam<Comps>...>
+    std::vector<EntityId> EntityWorld::addEntities(std::size_t count, Init &&init, const Comps &...prototypes)
+    {
+        auto index = getArchetype<Comps...>(sharedValuesOf(prototypes...));
 
-            auto it = std::lower_bound(comp_type_info.begin(), comp_type_info.end(), new_info);
-            comp_type_info.insert(it, new_info);
-            m_archetypes[entity.comp_ids].registerComps(comp_type_info);
-            if (!m_id2action_ids.contains(entity.comp_ids))
-            {
-                m_id2action_ids[entity.comp_ids] = {};
-            }
+        std::vector<EntityId> ids(count);
+        for (auto &id : ids)
+        {
+            id = m_entities.create().id;
         }
 
-        // auto old_size = component_data.size();
-        //! resize buffer to fit the new component
-        // component_data.resize(component_data.size() + sizeof(Comp));
-        // std::vector<std::byte> new_component(new_archetype.m_total_size);
+        m_archetypes[index].addEntities(std::span<const EntityId>(ids), init, prototypes...);
+        return ids;
+    }
+
+    template <Component Comp>
+    Archetype::Edge &EntityWorld::getAddEdge(ArchetypeIndex index)
+    {
+        static_assert(!SharedComponent<Comp>, "target of adding a shared component depends on its value, see setSharedValue");
+        auto &archetype = m_archetypes[index];
+        auto edge_it = archetype.m_add_edges.find(Comp::id);
+        if (edge_it != archetype.m_add_edges.end())
+        {
+            return edge_it->second;
+        }
 
-        auto &new_archetype = m_archetypes.at(entity.comp_ids);
-        //! construct components in new archetype
-        std::byte *new_entity_buffer = new_archetype.allocateNewEntity(entity_id);
-        //! construct the new component in newly created buffer
-        int offset = m_archetypes.at(entity.comp_ids).m_type2offsets.at(Comp::id);
-        std::construct_at(std::launder(reinterpret_cast<Comp *>(new_entity_buffer + offset)), comp);
-        //! move rest of the objects from the old buffer
-        const auto &old_offsets = archetype.m_type2offsets;
-        const auto &new_offsets = new_archetype.m_type2offsets;
-        for (auto &rtti : archetype.m_type_info)
+        auto new_id = m_archetypes.signature(index);
+        new_id.set(Comp::id);
+        auto new_index = findArchetype(new_id, archetype.sharedValues());
+        if (new_index == NO_ARCHETYPE) //! create the archetype if it is new
         {
-            assert(new_offsets.at(rtti.id) != offset); //! no object is build in added  component spot!
-            rtti.v_table->move(new_entity_buffer + new_offsets.at(rtti.id), component_data.data() + old_offsets.at(rtti.id));
+            //! correct type info, tags have none
+            auto comp_type_info = archetype.m_type_info;
+            if constexpr (!TagComponent<Comp>)
+            {
+                CompTypeInfo new_info = CompTypeInfo{Comp{}};
+                auto it = std::lower_bound(comp_type_info.begin(), comp_type_info.end(), new_info);
+                comp_type_info.insert(it, new_info);
+            }
+            new_index = m_archetypes.create(new_id, archetype.sharedValues());
+            m_archetypes[new_index].registerComps(comp_type_info, m_default_layout);
+            m_archetypes[new_index].setSharedValues(archetype.sharedValues());
+            onNewArchetype(new_index);
         }
+        connectArchetypes(index, new_index, Comp::id);
+        return archetype.m_add_edges.at(Comp::id);
     }
 
     template <Component Comp>
-    void EntityWorld::removeComponent(EntityId entity_id)
+    Archetype::Edge &EntityWorld::getRemoveEdge(ArchetypeIndex index)
     {
-        if (!has<Comp>(entity_id))
+        auto &archetype = m_archetypes[index];
+        auto edge_it = archetype.m_remove_edges.find(Comp::id);
+        if (edge_it != archetype.m_remove_edges.end())
         {
-            return; //! do nothing!
+            return edge_it->second;
         }
 
-        auto &entity = m_entities.at(entity_id);
-        auto &archetype = m_archetypes.at(entity.comp_ids);
-
-        entity.comp_ids[Comp::id] = false;
-        if (!m_archetypes.contains(entity.comp_ids)) //! create the archetype if it is new
+        auto new_id = m_archetypes.signature(index);
+        new_id.reset(Comp::id);
+        auto shared = archetype.sharedValues();
+        std::erase_if(shared, [](auto &value)
+                      { return value.id == Comp::id; });
+        auto new_index = findArchetype(new_id, shared);
+        if (new_index == NO_ARCHETYPE) //! create the archetype if it is new
         {
             //! erase removed component from rtti_info and add use it to register a new archetype
             auto type_info = archetype.m_type_info;
             type_info.erase(std::remove_if(type_info.begin(), type_info.end(), [id = Comp::id](auto &info)
                                            { return info.id == id; }),
                             type_info.end());
-            assert(type_info.size() == archetype.m_type_info.size() - 1); //! only on id should have existed
+            assert(type_info.size() == archetype.m_type_info.size() - (TagComponent<Comp> || SharedComponent<Comp> ? 0 : 1)); //! only on id should have existed
+
+            new_index = m_archetypes.create(new_id, shared);
+            m_archetypes[new_index].registerComps(type_info, m_default_layout);
+            m_archetypes[new_index].setSharedValues(std::move(shared));
+            onNewArchetype(new_index);
+        }
+        connectArchetypes(new_index, index, Comp::id);
+        return archetype.m_remove_edges.at(Comp::id);
+    }
 
-            m_archetypes[entity.comp_ids].registerComps(type_info);
-            if (!m_id2action_ids.contains(entity.comp_ids))
+    template <Component Comp>
+    void EntityWorld::addComponent(EntityId entity_id, Comp comp)
+    {
+        ECS_PROFILE_SCOPE(m_profiler, Profiler::ADD_COMPONENT, ProfileCategory::Structural);
+        if constexpr (SharedComponent<Comp>)
+        {
+            setSharedValue(entity_id, Archetype::SharedValue::of(comp));
+        }
+        else
+        {
+            if (has<Comp>(entity_id))
+            {
+                get<Comp>(entity_id) = std::move(comp); //! no migration, just overwrite
+                return;
+            }
+
+            auto &entity = m_entities.at(entity_id);
+            auto &archetype = m_archetypes[entity.archetype];
+            auto &edge = getAddEdge<Comp>(entity.archetype);
+            auto &new_archetype = *edge.target;
+
+            //! move the entity from it's current archetype to the new one and construct the added component there
+            auto new_comp_i = archetype.moveEntity(entity_id, edge);
+            if constexpr (!TagComponent<Comp>) //! tags have no storage
             {
-                m_id2action_ids[entity.comp_ids] = {};
+                std::construct_at(std::launder(reinterpret_cast<Comp *>(new_archetype.getComponentData(new_comp_i, edge.changed_column))), std::move(comp));
+                new_archetype.markAdded(new_comp_i, Comp::id);
             }
         }
-        auto &new_archetype = m_archetypes.at(entity.comp_ids);
+    }
 
-        auto component_data = archetype.removeEntityAndGetData(entity_id);
+    template <Component... Comps>
+    void EntityWorld::setLayout(ChunkLayout layout)
+    {
+        static_assert(!(SharedComponent<Comps> || ...), "archetypes with shared components depend on their values, which setLayout does not know");
+        auto id = getId<Comps...>();
+        assert(!m_archetypes.contains(id)); //! existing blocks would have to be repacked
+        auto index = m_archetypes.create(id);
+        m_archetypes[index].template registerComps<Comps...>(layout);
+        onNewArchetype(index);
+    }
 
-        std::byte *new_entity_buffer = new_archetype.allocateNewEntity(entity_id);
-        //! move all components from component_data to new buffer
-        auto &offsets = archetype.m_type2offsets;
-        auto &new_offsets = new_archetype.m_type2offsets;
-        for (auto &rtti : new_archetype.m_type_info)
+    template <Component Comp>
+    void EntityWorld::removeComponent(EntityId entity_id)
+    {
+        ECS_PROFILE_SCOPE(m_profiler, Profiler::REMOVE_COMPONENT, ProfileCategory::Structural);
+        if (!has<Comp>(entity_id))
         {
-            assert(rtti.id != Comp::id); //! none of the resting components can be the remove one!
-            rtti.v_table->move(new_entity_buffer + new_offsets.at(rtti.id), component_data.data() + offsets.at(rtti.id));
+            return; //! do nothing!
         }
-        //! destroy the removed component
-        std::destroy_at(std::launder(reinterpret_cast<Comp *>(component_data.data() + offsets.at(Comp::id))));
+
+        auto &entity = m_entities.at(entity_id);
+        auto &archetype = m_archetypes[entity.archetype];
+        auto &edge = getRemoveEdge<Comp>(entity.archetype);
+
+        //! the removed component is the only one dropped by the edge
+        archetype.moveEntity(entity_id, edge);
     }
 
 } // namespace ecs
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+
+namespace ecs
+{
+
+    namespace
+    {
+        const char *categoryName(ProfileCategory category)
+        {
+            switch (category)
+            {
+            case ProfileCategory::Query:
+                return "query";
+            case ProfileCategory::Structural:
+                return "structural";
+            case ProfileCategory::System:
+                return "system";
+            }
+            return "unknown";
+        }
+
+        void writeJsonString(std::ostream &os, std::string_view text)
+        {
+            os << '"';
+            for (char c : text)
+            {
+                switch (c)
+                {
+                case '"':
+                    os << "\\\"";
+                    break;
+                case '\\':
+                    os << "\\\\";
+                    break;
+                case '\n':
+                    os << "\\n";
+                    break;
+                case '\t':
+                    os << "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20)
+                    {
+                        char escaped[8];
+                        std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                        os << escaped;
+                    }
+                    else
+                    {
+                        os << c;
+                    }
+                }
+            }
+            os << '"';
+        }
+
+        //! prints ns as us with ns precision, the unit of Chrome traces
+        void writeMicroseconds(std::ostream &os, std::uint64_t ns)
+        {
+            char text[32];
+            std::snprintf(text, sizeof(text), "%llu.%03llu",
+                          static_cast<unsigned long long>(ns / 1000), static_cast<unsigned long long>(ns % 1000));
+            os << text;
+        }
+
+        std::atomic<std::uint64_t> next_profiler_id = 0;
+    } // namespace
+
+    Profiler::Profiler(std::size_t capacity)
+        : m_id(next_profiler_id++), m_epoch(std::chrono::steady_clock::now()), m_capacity(capacity)
+    {
+        assert(capacity > 0);
+        nameId("addComponent");
+        nameId("removeComponent");
+        nameId("removeEntity");
+        nameId("flush");
+    }
+
+    std::uint32_t Profiler::nameId(std::string_view name)
+    {
+        std::lock_guard lock(m_mutex);
+        auto id_it = m_name_ids.find(name);
+        if (id_it != m_name_ids.end())
+        {
+            return id_it->second;
+        }
+        auto id = static_cast<std::uint32_t>(m_names.size());
+        m_names.emplace_back(name);
+        m_name_ids.emplace(m_names.back(), id);
+        return id;
+    }
+
+    std::string Profiler::name(std::uint32_t id) const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_names.at(id);
+    }
+
+    std::uint64_t Profiler::now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+    }
+
+    void Profiler::record(const ProfileEvent &event)
+    {
+        auto &buffer = threadBuffer();
+        std::lock_guard lock(buffer.mutex);
+        buffer.events[buffer.next] = event;
+        buffer.next = (buffer.next + 1) % buffer.events.size();
+        buffer.recorded++;
+    }
+
+    Profiler::ThreadBuffer &Profiler::threadBuffer()
+    {
+        //! a few recently used buffers per thread, found without touching shared state
+        struct CacheEntry
+        {
+            std::uint64_t profiler_id;
+            ThreadBuffer *buffer;
+        };
+        constexpr std::size_t CACHE_SIZE = 4;
+        thread_local std::array<CacheEntry, CACHE_SIZE> cache{};
+        thread_local std::size_t cache_next = 0;
+        for (auto &entry : cache)
+        {
+            if (entry.buffer && entry.profiler_id == m_id) //! ids are never reused, so the buffer is still alive
+            {
+                return *entry.buffer;
+            }
+        }
+
+        std::lock_guard lock(m_mutex);
+        auto thread = threadNumber();
+        auto buffer_it = std::ranges::find_if(m_buffers, [thread](auto &buffer)
+                                              { return buffer->thread == thread; });
+        if (buffer_it == m_buffers.end())
+        {
+            auto buffer = std::make_unique<ThreadBuffer>();
+            buffer->events.resize(m_capacity);
+            buffer->thread = thread;
+            m_buffers.push_back(std::move(buffer));
+            buffer_it = m_buffers.end() - 1;
+        }
+        cache[cache_next] = {.profiler_id = m_id, .buffer = buffer_it->get()};
+        cache_next = (cache_next + 1) % CACHE_SIZE;
+        return **buffer_it;
+    }
+
+    std::vector<ProfileEvent> Profiler::events() const
+    {
+        std::lock_guard lock(m_mutex);
+        return collectEvents();
+    }
+
+    std::vector<ProfileEvent> Profiler::collectEvents() const
+    {
+        std::vector<ProfileEvent> events;
+        for (auto &buffer : m_buffers)
+        {
+            std::lock_guard lock(buffer->mutex);
+            if (buffer->recorded < buffer->events.size())
+            {
+                events.insert(events.end(), buffer->events.begin(), buffer->events.begin() + buffer->recorded);
+                continue;
+            }
+            //! the buffer is full, the oldest event is the one to be overwritten next
+            events.insert(events.end(), buffer->events.begin() + buffer->next, buffer->events.end());
+            events.insert(events.end(), buffer->events.begin(), buffer->events.begin() + buffer->next);
+        }
+        std::ranges::stable_sort(events, {}, &ProfileEvent::start);
+        return events;
+    }
+
+    std::size_t Profiler::droppedCount() const
+    {
+        std::lock_guard lock(m_mutex);
+        std::size_t dropped = 0;
+        for (auto &buffer : m_buffers)
+        {
+            std::lock_guard buffer_lock(buffer->mutex);
+            dropped += buffer->recorded > buffer->events.size() ? buffer->recorded - buffer->events.size() : 0;
+        }
+        return dropped;
+    }
+
+    void Profiler::clear()
+    {
+        std::lock_guard lock(m_mutex);
+        for (auto &buffer : m_buffers)
+        {
+            std::lock_guard buffer_lock(buffer->mutex);
+            buffer->next = 0;
+            buffer->recorded = 0;
+        }
+    }
+
+    void Profiler::writeChromeTrace(std::ostream &os) const
+    {
+        std::lock_guard lock(m_mutex);
+        os << "{\"traceEvents\":[";
+        bool first = true;
+        for (const auto &event : collectEvents())
+        {
+            os << (first ? "\n" : ",\n");
+            first = false;
+            os << "{\"name\":";
+            writeJsonString(os, m_names.at(event.name));
+            os << ",\"cat\":\"" << categoryName(event.category) << "\",\"ph\":\"X\",\"ts\":";
+            writeMicroseconds(os, event.start);
+            os << ",\"dur\":";
+            writeMicroseconds(os, event.duration);
+            os << ",\"pid\":0,\"tid\":" << event.thread;
+            if (event.category == ProfileCategory::Query)
+            {
+                os << ",\"args\":{\"archetypes\":" << event.stats.archetypes << ",\"chunks\":" << event.stats.chunks
+                   << ",\"rows\":" << event.stats.rows << "}";
+            }
+            os << "}";
+        }
+        os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    }
+
+    std::uint32_t Profiler::threadNumber()
+    {
+        static std::atomic<std::uint32_t> next_number = 0;
+        thread_local std::uint32_t number = next_number++;
+        return number;
+    }
+
+} // namespace ecs
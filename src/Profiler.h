@@ -0,0 +1,158 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ecs
+{
+
+    //! work done by one pass over a query
+    struct QueryStats
+    {
+        std::size_t archetypes = 0; //!< matched archetypes passing the filters
+        std::size_t chunks = 0;     //!< visited chunks
+        std::size_t rows = 0;       //!< entities in visited chunks
+    };
+
+    enum class ProfileCategory : std::uint8_t
+    {
+        Query,      //!< forEach and friends, events carry QueryStats
+        Structural, //!< component adds and removes, entity removals, flushes
+        System      //!< one run of a system of a SystemScheduler
+    };
+
+    struct ProfileEvent
+    {
+        std::uint32_t name;       //!< id returned by Profiler::nameId
+        ProfileCategory category;
+        std::uint32_t thread;     //!< Profiler::threadNumber() of the recording thread
+        std::uint64_t start;      //!< ns since creation of the profiler
+        std::uint64_t duration;   //!< ns
+        QueryStats stats;         //!< only filled for ProfileCategory::Query
+    };
+
+    //! Keeps the latest events of each thread in a fixed size ring buffer of that thread, older ones get overwritten
+    //! (and counted as dropped). Threads record into their own buffers, so they do not contend with each other.
+    //! Names are interned once so that recording an event copies only a few integers.
+    //! All member functions may be called from any thread.
+    class Profiler
+    {
+    public:
+        static constexpr std::size_t DEFAULT_CAPACITY = 1 << 16;
+
+        //! ids of names every profiler interns on construction
+        static constexpr std::uint32_t ADD_COMPONENT = 0;
+        static constexpr std::uint32_t REMOVE_COMPONENT = 1;
+        static constexpr std::uint32_t REMOVE_ENTITY = 2;
+        static constexpr std::uint32_t FLUSH = 3;
+
+        //! capacity is the number of events kept per thread
+        explicit Profiler(std::size_t capacity = DEFAULT_CAPACITY);
+
+        //! \returns id of name, the same name always gets the same id
+        std::uint32_t nameId(std::string_view name);
+        std::string name(std::uint32_t id) const;
+
+        //! \returns ns elapsed since creation of the profiler
+        std::uint64_t now() const;
+
+        void record(const ProfileEvent &event);
+
+        //! \returns recorded events still in the buffers of all threads, ordered by start
+        std::vector<ProfileEvent> events() const;
+        //! \returns number of events overwritten since the last clear
+        std::size_t droppedCount() const;
+        void clear();
+
+        //! writes events in the Chrome trace event format (JSON), to be opened in chrome://tracing or Perfetto
+        void writeChromeTrace(std::ostream &os) const;
+
+        //! \returns small number identifying the calling thread, assigned on first call
+        static std::uint32_t threadNumber();
+
+    private:
+        //! ring buffer of one thread, its mutex is contended only by readers of the events
+        struct ThreadBuffer
+        {
+            mutable std::mutex mutex;
+            std::vector<ProfileEvent> events;
+            std::size_t next = 0;     //!< slot the next event goes to
+            std::size_t recorded = 0; //!< events recorded since the last clear
+            std::uint32_t thread;     //!< threadNumber() of the owner
+        };
+
+        //! \returns buffer of the calling thread, created on its first event
+        ThreadBuffer &threadBuffer();
+        //! \returns events of all buffers ordered by start
+        std::vector<ProfileEvent> collectEvents() const;
+
+        std::uint64_t m_id; //!< unique among all profilers ever created, threads cache their buffers by it
+        std::chrono::steady_clock::time_point m_epoch;
+        std::size_t m_capacity;
+
+        mutable std::mutex m_mutex; //!< guards m_buffers and the names
+        std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+
+        std::deque<std::string> m_names; //!< indexed by name id
+        std::unordered_map<std::string_view, std::uint32_t> m_name_ids; //!< views into m_names
+    };
+
+    //! records an event spanning its lifetime
+    class ProfileScope
+    {
+    public:
+        ProfileScope(Profiler &profiler, std::uint32_t name, ProfileCategory category)
+            : m_profiler(profiler), m_name(name), m_category(category), m_start(profiler.now()) {}
+
+        ~ProfileScope()
+        {
+            m_profiler.record({.name = m_name,
+                               .category = m_category,
+                               .thread = Profiler::threadNumber(),
+                               .start = m_start,
+                               .duration = m_profiler.now() - m_start,
+                               .stats = m_stats});
+        }
+
+        ProfileScope(const ProfileScope &) = delete;
+        ProfileScope &operator=(const ProfileScope &) = delete;
+
+        //! stats are known only once the query ran, they go into the event recorded at the end of the scope
+        void setStats(const QueryStats &stats)
+        {
+            m_stats = stats;
+        }
+
+    private:
+        Profiler &m_profiler;
+        std::uint32_t m_name;
+        ProfileCategory m_category;
+        QueryStats m_stats;
+        std::uint64_t m_start;
+    };
+
+} // namespace ecs
+
+#define ECS_PROFILE_CONCAT_IMPL(a, b) a##b
+#define ECS_PROFILE_CONCAT(a, b) ECS_PROFILE_CONCAT_IMPL(a, b)
+
+//! times the rest of the enclosing block, takes the arguments of the ProfileScope constructor
+//! ECS_PROFILE_NAMED_SCOPE(scope, ...) does the same with a scope which ECS_PROFILE_STATS(scope, stats) can add stats to
+//! without ECS_PROFILING they expand to nothing and the arguments are not evaluated
+#ifdef ECS_PROFILING
+#define ECS_PROFILE_SCOPE(...) ::ecs::ProfileScope ECS_PROFILE_CONCAT(ecs_profile_scope_, __LINE__)(__VA_ARGS__)
+#define ECS_PROFILE_NAMED_SCOPE(scope, ...) ::ecs::ProfileScope scope(__VA_ARGS__)
+#define ECS_PROFILE_STATS(scope, stats) scope.setStats(stats)
+#else
+#define ECS_PROFILE_SCOPE(...)
+#define ECS_PROFILE_NAMED_SCOPE(scope, ...)
+#define ECS_PROFILE_STATS(scope, stats)
+#endif
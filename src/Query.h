@@ -0,0 +1,353 @@
+#pragma once
+
+#include "Archetype.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+
+#include <atomic>
+
+namespace ecs
+{
+
+    //! gives each list of query terms a unique index, independent of component ids
+    class QueryIdGenerator
+    {
+    public:
+        template <class QueryType>
+        static std::size_t getId()
+        {
+            static const std::size_t id = m_count++;
+            return id;
+        }
+
+    private:
+        inline static std::atomic<std::size_t> m_count = 0;
+    };
+
+    //! query term excluding archetypes which contain Comp, resolved once per archetype when it gets matched
+    template <Component Comp>
+    struct Without
+    {
+        static void addIds(ArchetypeId &, ArchetypeId &excluded)
+        {
+            excluded.set(Comp::id);
+        }
+
+        static bool matchesArchetype(const Archetype &archetype)
+        {
+            return !archetype.hasComponent(Comp::id);
+        }
+
+        static bool matches(const Archetype &, std::size_t, Tick)
+        {
+            return true;
+        }
+    };
+
+    //! query filter passing chunks in which a Comp component was written at or after the tick since
+    template <Component Comp>
+    struct Changed
+    {
+        static_assert(!TagComponent<Comp>, "tags have no data which could change");
+        static_assert(!SharedComponent<Comp>, "shared components change only by moving entities, which marks their other components");
+
+        static void addIds(ArchetypeId &required, ArchetypeId &)
+        {
+            required.set(Comp::id);
+        }
+
+        static bool matchesArchetype(const Archetype &archetype)
+        {
+            return archetype.hasComponent(Comp::id);
+        }
+
+        static bool matches(const Archetype &archetype, std::size_t chunk_i, Tick since)
+        {
+            return archetype.changedTick(chunk_i, Comp::id) >= since;
+        }
+    };
+
+    //! query filter passing chunks in which a Comp component was added to an entity at or after the tick since
+    template <Component Comp>
+    struct Added
+    {
+        static_assert(!TagComponent<Comp> && !SharedComponent<Comp>, "tags and shared components have no storage, so their additions are not tracked");
+
+        static void addIds(ArchetypeId &required, ArchetypeId &)
+        {
+            required.set(Comp::id);
+        }
+
+        static bool matchesArchetype(const Archetype &archetype)
+        {
+            return archetype.hasComponent(Comp::id);
+        }
+
+        static bool matches(const Archetype &archetype, std::size_t chunk_i, Tick since)
+        {
+            return archetype.addedTick(chunk_i, Comp::id) >= since;
+        }
+    };
+
+    //! adds components required and excluded by a query term or filter
+    template <class Term>
+    void addTermIds(ArchetypeId &required, ArchetypeId &excluded)
+    {
+        if constexpr (QueryTerm<Term>)
+        {
+            if constexpr (!TermAccess<Term>::optional)
+            {
+                required.set(Term::id);
+            }
+        }
+        else
+        {
+            Term::addIds(required, excluded);
+        }
+    }
+
+    //! maps a parameter of a forEach callable onto a query term: Comp& -> Comp, const Comp& -> const Comp, Comp* -> Optional<Comp>
+    template <class Param>
+    struct ParamTerm
+    {
+        using type = std::remove_reference_t<Param>;
+    };
+    template <class Comp>
+    struct ParamTerm<Comp *>
+    {
+        using type = Optional<Comp>;
+    };
+
+    //! maps a parameter of a forEachChunk callable onto a query term: ColumnView<Comp> -> Comp, const Comp& -> const Comp
+    //! the latter only for shared components
+    template <class Param>
+    struct ChunkParamTerm;
+    template <class Comp>
+    struct ChunkParamTerm<ColumnView<Comp>>
+    {
+        using type = Comp;
+    };
+    template <SharedComponent Comp>
+    struct ChunkParamTerm<const Comp &>
+    {
+        using type = const Comp;
+    };
+
+    //! type erased interface which lets EntityWorld notify queries about new archetypes
+    class QueryBase
+    {
+    public:
+        QueryBase(ArchetypeId id, ArchetypeId excluded) : m_id(id), m_excluded(excluded) {}
+        virtual ~QueryBase() = default;
+
+        //! adds the archetype to matched ones if it contains all required components and none of the excluded
+        virtual void addArchetype(const ArchetypeId &id, Archetype &archetype) = 0;
+
+        const ArchetypeId &getId() const
+        {
+            return m_id;
+        }
+
+#ifdef ECS_PROFILING
+        std::uint32_t profile_name = 0; //!< name of the query in the profiler of its world
+#endif
+
+    protected:
+        bool matches(const ArchetypeId &id) const
+        {
+            return m_id <= id && !id.intersects(m_excluded);
+        }
+
+        ArchetypeId m_id;       //!< components required by the query
+        ArchetypeId m_excluded; //!< components which matched archetypes must not contain
+    };
+
+    //! cached list of archetypes holding all of Comps... together with offsets of the Comps... in them
+    //! the list is filled once at creation and then updated only when a new archetype gets created
+    //! Optional<Comp> terms do not restrict matching, actions get nullptr for them in archetypes without Comp
+    template <QueryTerm... Comps>
+    class Query : public QueryBase
+    {
+    public:
+        using Offsets = std::array<std::size_t, sizeof...(Comps)>;
+
+        Query(ArchetypeId id, ArchetypeId excluded) : QueryBase(id, excluded) {}
+
+        void addArchetype(const ArchetypeId &id, Archetype &archetype) override
+        {
+            if (matches(id))
+            {
+                m_archetypes.push_back(&archetype);
+                m_offsets.push_back(archetype.template getOffsets<Comps...>());
+                if constexpr (STATIC_IDS)
+                {
+                    m_static_layout.push_back(id == archetypeIdOf<Comps...>() && archetype.layout() == ChunkLayout::AoS);
+                }
+            }
+        }
+
+        //! calls callable(Comps&...) on every entity having all of Comps...
+        //! \returns what got visited, counted per archetype so that it costs nothing per entity
+        template <class Callable>
+        QueryStats forEach(Callable &&callable)
+        {
+            QueryStats stats;
+            for (std::size_t i = 0; i < m_archetypes.size(); ++i)
+            {
+                countArchetype(stats, *m_archetypes[i]);
+                if constexpr (STATIC_IDS)
+                {
+                    if (m_static_layout[i])
+                    {
+                        m_archetypes[i]->template forEachStatic<std::remove_reference_t<Callable> &, Comps...>(callable);
+                        continue;
+                    }
+                }
+                m_archetypes[i]->template forEach2<std::remove_reference_t<Callable> &, Comps...>(callable, m_offsets[i]);
+            }
+            return stats;
+        }
+
+        //! calls callable(ids, ColumnView<Comps>...) once per used chunk of every matched archetype
+        template <class Callable>
+        QueryStats forEachChunk(Callable &&callable)
+        {
+            QueryStats stats;
+            for (std::size_t i = 0; i < m_archetypes.size(); ++i)
+            {
+                countArchetype(stats, *m_archetypes[i]);
+                m_archetypes[i]->template forEachChunk<std::remove_reference_t<Callable> &, Comps...>(
+                    callable, m_offsets[i], 0, m_archetypes[i]->usedChunkCount());
+            }
+            return stats;
+        }
+
+        //! same as forEach but whole chunks not passing all of Filters... (Changed<Comp>, Added<Comp>) get skipped
+        //! archetypes not passing Filters... (e.g. without the filtered components) are skipped too
+        template <class... Filters, class Callable>
+        QueryStats forEach(Callable &&callable, Tick since)
+        {
+            QueryStats stats;
+            for (std::size_t i = 0; i < m_archetypes.size(); ++i)
+            {
+                auto &archetype = *m_archetypes[i];
+                if (!(Filters::matchesArchetype(archetype) && ...))
+                {
+                    continue;
+                }
+                stats.archetypes++;
+                for (std::size_t chunk_i = 0; chunk_i < archetype.usedChunkCount(); ++chunk_i)
+                {
+                    if ((Filters::matches(archetype, chunk_i, since) && ...))
+                    {
+                        countChunk(stats, archetype, chunk_i);
+                        archetype.template forEach2<std::remove_reference_t<Callable> &, Comps...>(
+                            callable, m_offsets[i], chunk_i, chunk_i + 1);
+                    }
+                }
+            }
+            return stats;
+        }
+
+        //! forEachChunk skipping chunks not passing all of Filters..., see filtered forEach
+        template <class... Filters, class Callable>
+        QueryStats forEachChunk(Callable &&callable, Tick since)
+        {
+            QueryStats stats;
+            for (std::size_t i = 0; i < m_archetypes.size(); ++i)
+            {
+                auto &archetype = *m_archetypes[i];
+                if (!(Filters::matchesArchetype(archetype) && ...))
+                {
+                    continue;
+                }
+                stats.archetypes++;
+                for (std::size_t chunk_i = 0; chunk_i < archetype.usedChunkCount(); ++chunk_i)
+                {
+                    if ((Filters::matches(archetype, chunk_i, since) && ...))
+                    {
+                        countChunk(stats, archetype, chunk_i);
+                        archetype.template forEachChunk<std::remove_reference_t<Callable> &, Comps...>(
+                            callable, m_offsets[i], chunk_i, chunk_i + 1);
+                    }
+                }
+            }
+            return stats;
+        }
+
+        //! same as forEach, but groups of grain_size chunks are processed as separate tasks in the pool
+        //! callable gets called concurrently so it must not modify shared state without synchronization
+        template <class Callable>
+        QueryStats parallelForEach(ThreadPool &pool, Callable &&callable, std::size_t grain_size = 1)
+        {
+            assert(grain_size > 0);
+
+            QueryStats stats;
+            struct ChunkRange
+            {
+                std::size_t archetype_i;
+                std::size_t chunk_begin;
+                std::size_t chunk_end;
+            };
+            std::vector<ChunkRange> tasks;
+            for (std::size_t i = 0; i < m_archetypes.size(); ++i)
+            {
+                countArchetype(stats, *m_archetypes[i]);
+                auto chunk_count = m_archetypes[i]->usedChunkCount();
+                for (std::size_t chunk_i = 0; chunk_i < chunk_count; chunk_i += grain_size)
+                {
+                    tasks.push_back({i, chunk_i, std::min(chunk_i + grain_size, chunk_count)});
+                }
+            }
+
+            pool.parallelFor(tasks.size(), [&](std::size_t task_i)
+                             {
+                auto& task = tasks[task_i];
+                m_archetypes[task.archetype_i]->template forEach2<std::remove_reference_t<Callable> &, Comps...>(
+                    callable, m_offsets[task.archetype_i], task.chunk_begin, task.chunk_end); });
+            return stats;
+        }
+
+        std::size_t archetypeCount() const
+        {
+            return m_archetypes.size();
+        }
+
+    private:
+        static void countArchetype(QueryStats &stats, const Archetype &archetype)
+        {
+            stats.archetypes++;
+            stats.chunks += archetype.usedChunkCount();
+            stats.rows += archetype.entityCount();
+        }
+
+        static void countChunk(QueryStats &stats, const Archetype &archetype, std::size_t chunk_i)
+        {
+            stats.chunks++;
+            stats.rows += archetype.chunkEntities(chunk_i).size();
+        }
+
+        //! all Comps... are plain components with static ids, so offsets in the archetype made of exactly them are known at compile time
+        static constexpr bool STATIC_IDS = (!TermAccess<Comps>::optional && ...) && (TermAccess<Comps>::Type::static_id && ...);
+
+        std::vector<Archetype *> m_archetypes; //!< matched archetypes
+        std::vector<Offsets> m_offsets;        //!< offsets of Comps... in each of m_archetypes
+        std::vector<bool> m_static_layout;     //!< m_archetypes[i] is the AoS archetype made of exactly Comps..., only with STATIC_IDS
+    };
+
+    template <class Term>
+    using ParamTermsOf = std::conditional_t<QueryTerm<Term>, std::tuple<Term>, std::tuple<>>;
+    template <class Tuple>
+    struct QueryOfTuple;
+    template <class... Comps>
+    struct QueryOfTuple<std::tuple<Comps...>>
+    {
+        using type = Query<Comps...>;
+    };
+
+    //! query type for Terms..., i.e. Query over the Terms... handed to actions (components and Optional ones)
+    //! Without, Changed and Added terms influence only which archetypes get matched
+    template <class... Terms>
+    using QueryOf = typename QueryOfTuple<decltype(std::tuple_cat(std::declval<ParamTermsOf<Terms>>()...))>::type;
+
+} // namespace ecs
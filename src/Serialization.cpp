@@ -0,0 +1,24 @@
+#include "Serialization.h"
+
+#include <string>
+
+namespace ecs
+{
+
+    const ComponentRegistry::Entry &ComponentRegistry::at(int comp_id)
+    {
+        auto entry_it = entries().find(comp_id);
+        if (entry_it == entries().end())
+        {
+            throw std::runtime_error("component " + std::to_string(comp_id) + " is not registered for serialization");
+        }
+        return entry_it->second;
+    }
+
+    std::unordered_map<int, ComponentRegistry::Entry> &ComponentRegistry::entries()
+    {
+        static std::unordered_map<int, Entry> entries;
+        return entries;
+    }
+
+} // namespace ecs
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "Archetype.h"
+
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+namespace ecs
+{
+
+    //! components which are not trivially copyable have to write and read themselves,
+    //! load gets called on a default constructed component
+    template <class Comp>
+    concept SelfSerializable = requires(Comp comp, const Comp const_comp, std::ostream &os, std::istream &is) {
+        const_comp.save(os);
+        comp.load(is);
+    };
+
+    //! snapshots are plain memory dumps, so they can be read only on machines with the same endianness and type sizes
+    inline void writeBytes(std::ostream &os, std::span<const std::byte> bytes)
+    {
+        os.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    //! \throws std::runtime_error if the stream ends before bytes got filled
+    inline void readBytes(std::istream &is, std::span<std::byte> bytes)
+    {
+        if (!is.read(reinterpret_cast<char *>(bytes.data()), static_cast<std::streamsize>(bytes.size())))
+        {
+            throw std::runtime_error("world snapshot ended unexpectedly");
+        }
+    }
+
+    //! reads count elements in batches, so that a corrupt count fails at the end of the stream instead of allocating
+    //! all of it up front
+    template <class T>
+    std::vector<T> readVector(std::istream &is, std::uint64_t count)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        constexpr std::uint64_t BATCH_SIZE = 1 << 16;
+        std::vector<T> values;
+        while (values.size() < count)
+        {
+            auto begin = values.size();
+            values.resize(begin + std::min(BATCH_SIZE, count - begin));
+            readBytes(is, std::as_writable_bytes(std::span(values).subspan(begin)));
+        }
+        return values;
+    }
+
+    template <class T>
+    void writeRaw(std::ostream &os, const T &value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        writeBytes(os, std::as_bytes(std::span(&value, 1)));
+    }
+
+    template <class T>
+    T readRaw(std::istream &is)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        readBytes(is, std::as_writable_bytes(std::span(&value, 1)));
+        return value;
+    }
+
+    //! Maps component ids onto everything needed to save and load components of that type.
+    //! Loading knows only the ids, so every component type stored in a snapshot has to be registered by add first
+    //! (in the loading process, ids have to be the same as in the saving one, e.g. static ids).
+    class ComponentRegistry
+    {
+    public:
+        struct Entry
+        {
+            CompTypeInfo type_info;
+            void (*write)(std::ostream &os, const void *comp) = nullptr;        //!< writes the component at comp
+            void (*read)(std::istream &is, void *dest) = nullptr;               //!< constructs a component at dest
+            void (*construct)(void *dest) = nullptr;                            //!< default constructs a component at dest
+            Archetype::SharedValue (*read_shared)(std::istream &is) = nullptr; //!< reads value of a shared component
+            const std::type_info *type = nullptr;                              //!< component type owning the id
+        };
+
+        //! adding a component again is fine
+        //! \throws std::logic_error if another component was added with the same id, e.g. a duplicate static id
+        template <Component... Comps>
+        static void add();
+
+        //! \throws std::runtime_error if no component with comp_id was added
+        static const Entry &at(int comp_id);
+
+    private:
+        static std::unordered_map<int, Entry> &entries();
+    };
+
+    template <Component... Comps>
+    void ComponentRegistry::add()
+    {
+        auto add_one = []<Component Comp>(std::type_identity<Comp>)
+        {
+            static_assert(std::is_trivially_copyable_v<Comp> || SelfSerializable<Comp>,
+                          "components which are not trivially copyable need save(std::ostream&) const and load(std::istream&)");
+            auto entry_it = entries().find(Comp::id);
+            if (entry_it != entries().end() && *entry_it->second.type != typeid(Comp))
+            {
+                throw std::logic_error(std::string("ComponentRegistry::add: ") + typeid(Comp).name() + " has the same id " +
+                                       std::to_string(Comp::id) + " as " + entry_it->second.type->name());
+            }
+            Entry entry{.type_info = CompTypeInfo{Comp{}}, .type = &typeid(Comp)};
+            entry.construct = [](void *dest)
+            { std::construct_at(static_cast<Comp *>(dest)); };
+            if constexpr (std::is_trivially_copyable_v<Comp>)
+            {
+                entry.write = [](std::ostream &os, const void *comp)
+                { writeBytes(os, {static_cast<const std::byte *>(comp), sizeof(Comp)}); };
+                entry.read = [](std::istream &is, void *dest)
+                { readBytes(is, {static_cast<std::byte *>(dest), sizeof(Comp)}); };
+            }
+            else
+            {
+                entry.write = [](std::ostream &os, const void *comp)
+                { static_cast<const Comp *>(comp)->save(os); };
+                entry.read = [](std::istream &is, void *dest)
+                { std::construct_at(static_cast<Comp *>(dest))->load(is); };
+            }
+            if constexpr (SharedComponent<Comp>)
+            {
+                entry.read_shared = [](std::istream &is)
+                {
+                    Comp comp{};
+                    if constexpr (std::is_trivially_copyable_v<Comp>)
+                    {
+                        readBytes(is, std::as_writable_bytes(std::span(&comp, 1)));
+                    }
+                    else
+                    {
+                        comp.load(is);
+                    }
+                    return Archetype::SharedValue::of(comp);
+                };
+            }
+            entries().insert_or_assign(Comp::id, entry);
+        };
+        (add_one(std::type_identity<std::remove_cv_t<Comps>>{}), ...);
+    }
+
+} // namespace ecs
@@ -0,0 +1,131 @@
+#include "SystemScheduler.h"
+
+#include <atomic>
+#include <thread>
+
+namespace ecs
+{
+
+    bool SystemAccess::conflicts(const SystemAccess &other) const
+    {
+        return exclusive || other.exclusive ||
+               writes.intersects(other.writes) || writes.intersects(other.reads) || reads.intersects(other.writes);
+    }
+
+    SystemScheduler::SystemScheduler(EntityWorld &world)
+        : m_world(world) {}
+
+    SystemId SystemScheduler::registerSystem(std::string name, SystemAccess access, std::function<void(EntityWorld &, Tick since)> run)
+    {
+        m_systems.push_back({.name = std::move(name), .access = std::move(access), .run = std::move(run)});
+#ifdef ECS_PROFILING
+        m_systems.back().profile_name = m_world.profiler().nameId(m_systems.back().name);
+#endif
+        return m_systems.size() - 1;
+    }
+
+    void SystemScheduler::run()
+    {
+        auto system_count = m_systems.size();
+        if (system_count == 0)
+        {
+            return;
+        }
+
+        //! system j depends on every earlier system i it conflicts with
+        std::vector<std::vector<SystemId>> dependents(system_count);
+        std::vector<std::atomic<std::size_t>> dependency_counts(system_count);
+        ArchetypeId written;
+        for (SystemId j = 0; j < system_count; ++j)
+        {
+            for (SystemId i = 0; i < j; ++i)
+            {
+                if (m_systems[i].access.conflicts(m_systems[j].access))
+                {
+                    dependents[i].push_back(j);
+                    dependency_counts[j]++;
+                }
+            }
+            for (auto comp_id : m_systems[j].access.writes.ids())
+            {
+                written.set(comp_id);
+            }
+        }
+
+        //! copying chunks shared with forks on the first write would race with systems reading other columns of them
+        m_world.unshareChunks(written);
+
+        //! writes of this run get a tick of their own, so that filters of the next run can tell them apart
+        auto tick = m_world.advanceTick();
+
+        auto &pool = m_world.getThreadPool();
+        m_world.m_queries_frozen = true;
+        std::atomic<std::size_t> remaining = system_count;
+        std::function<void(SystemId)> start = [&](SystemId system)
+        {
+            pool.submit([&, system]()
+                        {
+                            //! exclusive systems run alone, they may create queries
+                            auto exclusive = m_systems[system].access.exclusive;
+                            if (exclusive)
+                            {
+                                m_world.m_queries_frozen = false;
+                            }
+                            {
+                                ECS_PROFILE_SCOPE(m_world.profiler(), m_systems[system].profile_name, ProfileCategory::System);
+                                m_systems[system].run(m_world, m_systems[system].last_run);
+                            }
+                            if (exclusive)
+                            {
+                                m_world.m_queries_frozen = true;
+                            }
+                            m_systems[system].last_run = tick;
+                            for (auto dependent : dependents[system])
+                            {
+                                if (--dependency_counts[dependent] == 0)
+                                {
+                                    start(dependent);
+                                }
+                            }
+                            remaining--; });
+        };
+        //! roots are collected first, started systems may already start their dependents
+        std::vector<SystemId> roots;
+        for (SystemId system = 0; system < system_count; ++system)
+        {
+            if (dependency_counts[system] == 0)
+            {
+                roots.push_back(system);
+            }
+        }
+        for (auto root : roots)
+        {
+            start(root);
+        }
+
+        while (remaining > 0)
+        {
+            if (!pool.runPendingTask())
+            {
+                std::this_thread::yield();
+            }
+        }
+        m_world.m_queries_frozen = false;
+    }
+
+    std::size_t SystemScheduler::systemCount() const
+    {
+        return m_systems.size();
+    }
+
+    const std::string &SystemScheduler::name(SystemId system) const
+    {
+        return m_systems.at(system).name;
+    }
+
+    const SystemAccess &SystemScheduler::access(SystemId system) const
+    {
+        return m_systems.at(system).access;
+    }
+
+} // namespace ecs
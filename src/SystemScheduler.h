@@ -0,0 +1,162 @@
+#pragma once
+
+#include "EntityWorld.h"
+
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include <functional>
+
+namespace ecs
+{
+
+    using SystemId = std::size_t;
+
+    //! component types a system reads and writes
+    struct SystemAccess
+    {
+        ArchetypeId reads;
+        ArchetypeId writes;
+        bool exclusive = false; //!< system needs the whole world (e.g. changes it structurally), it never runs alongside others
+
+        //! \returns true if one of the systems writes a component the other one accesses, such systems must not run together
+        bool conflicts(const SystemAccess &other) const;
+    };
+
+    //! Runs registered systems of a world once per run() call.
+    //! Each run builds a dependency graph: a system waits for every system registered before it whose access conflicts
+    //! with its own, the others run at the same time on the thread pool of the world.
+    //! So systems which conflict always run in the order of registration and the result of a run does not depend on timing.
+    //! Each run starts a new tick of the world, Changed and Added filters of a system pass chunks written since the start
+    //! of its previous run (everything on its first run), writes it saw already in that run may pass again.
+    //! Systems must not throw and must not change the world structurally unless exclusive, structural changes go
+    //! into world.commands() and get applied by world.flush() after the run.
+    class SystemScheduler
+    {
+    public:
+        explicit SystemScheduler(EntityWorld &world);
+
+        //! registers callable as a system calling world.forEach<Filters...>(callable, since) on each run
+        //! its access follows from the parameters of callable: const Comp& and const Comp* read, Comp& and Comp* write,
+        //! components of Changed and Added filters are read too (their ticks)
+        //! e.g. addSystem("move", [](Position& p, const Velocity& v){...}) writes Position and reads Velocity
+        template <class... Filters, typename Callable>
+        SystemId addSystem(std::string name, Callable &&callable);
+
+        //! registers a system calling run(world) on each run, it must not access more than access declares
+        //! queries must not be created while other systems run, so each query run uses (world.query<Terms...>() or a
+        //! forEach with the same terms) has to be listed in Queries as std::tuple<Terms...>, unless the system is exclusive
+        //! e.g. addSystem<std::tuple<const CompA, Without<CompB>>>("count", access, [](EntityWorld& world)
+        //!     { world.forEach<Without<CompB>>([](const CompA& a){...}); });
+        //! forEach callables give the terms ParamTerm<Param>::type, i.e. their parameters without references,
+        //! followed by the filters
+        template <class... Queries>
+        SystemId addSystem(std::string name, SystemAccess access, std::function<void(EntityWorld &)> run);
+
+        //! runs all systems once and returns when all of them finished
+        //! the calling thread runs systems too
+        void run();
+
+        std::size_t systemCount() const;
+        const std::string &name(SystemId system) const;
+        const SystemAccess &access(SystemId system) const;
+
+    private:
+        struct System
+        {
+            std::string name;
+            SystemAccess access;
+            std::function<void(EntityWorld &, Tick since)> run; //!< since is the tick of the previous run
+            Tick last_run = 0;
+#ifdef ECS_PROFILING
+            std::uint32_t profile_name = 0; //!< name in the profiler of the world
+#endif
+        };
+
+        template <class... Filters, typename C, typename R, class... Params>
+        SystemId addForEachSystem(std::string name, C &&callable, const std::function<R(Params...)> &);
+
+        //! creates the query over the terms of the tuple
+        template <class... Terms>
+        void createQuery(std::type_identity<std::tuple<Terms...>>);
+
+        //! adds the component of a forEach parameter to reads or writes of access
+        template <class Param>
+        static void addParamAccess(SystemAccess &access);
+
+        //! run gets the tick of the previous run of the system
+        SystemId registerSystem(std::string name, SystemAccess access, std::function<void(EntityWorld &, Tick since)> run);
+
+        EntityWorld &m_world;
+        std::vector<System> m_systems; //!< in the order of registration
+    };
+
+    template <class... Filters, typename Callable>
+    SystemId SystemScheduler::addSystem(std::string name, Callable &&callable)
+    {
+        using std_function_type = decltype(std::function{std::forward<Callable>(callable)});
+        return addForEachSystem<Filters...>(std::move(name), std::forward<Callable>(callable), std_function_type{});
+    }
+
+    template <class... Queries>
+    SystemId SystemScheduler::addSystem(std::string name, SystemAccess access, std::function<void(EntityWorld &)> run)
+    {
+        (createQuery(std::type_identity<Queries>{}), ...);
+        return registerSystem(std::move(name), std::move(access), [run = std::move(run)](EntityWorld &world, Tick)
+                              { run(world); });
+    }
+
+    template <class... Terms>
+    void SystemScheduler::createQuery(std::type_identity<std::tuple<Terms...>>)
+    {
+        m_world.query<Terms...>();
+    }
+
+    template <class... Filters, typename C, typename R, class... Params>
+    SystemId SystemScheduler::addForEachSystem(std::string name, C &&callable, const std::function<R(Params...)> &)
+    {
+        static_assert(std::is_same_v<void, R>);
+
+        SystemAccess access;
+        (addParamAccess<Params>(access), ...);
+        //! filters read the ticks of the components they require
+        ArchetypeId filtered;
+        ArchetypeId excluded;
+        (Filters::addIds(filtered, excluded), ...);
+        for (auto comp_id : filtered.ids())
+        {
+            if (!access.writes.test(comp_id))
+            {
+                access.reads.set(comp_id);
+            }
+        }
+        //! created now, so that running systems only look the query up
+        m_world.query<typename ParamTerm<Params>::type..., Filters...>();
+        return registerSystem(std::move(name), access, [callable = std::forward<C>(callable)](EntityWorld &world, Tick since) mutable
+                         {
+                             if constexpr (sizeof...(Filters) == 0)
+                             {
+                                 world.forEach(callable);
+                             }
+                             else
+                             {
+                                 world.forEach<Filters...>(callable, since);
+                             } });
+    }
+
+    template <class Param>
+    void SystemScheduler::addParamAccess(SystemAccess &access)
+    {
+        using Comp = typename TermAccess<typename ParamTerm<Param>::type>::Type;
+        if constexpr (std::is_const_v<Comp> || TagComponent<Comp>) //! tags have no data to write
+        {
+            access.reads.set(Comp::id);
+        }
+        else
+        {
+            access.writes.set(Comp::id);
+        }
+    }
+
+} // namespace ecs
@@ -0,0 +1,151 @@
+#include "ThreadPool.h"
+
+namespace ecs
+{
+
+    ThreadPool::ThreadPool(std::size_t thread_count)
+    {
+        auto queue_count = std::max<std::size_t>(thread_count, 1);
+        for (std::size_t i = 0; i < queue_count; ++i)
+        {
+            m_queues.push_back(std::make_unique<WorkQueue>());
+        }
+        for (std::size_t i = 0; i < thread_count; ++i)
+        {
+            m_workers.emplace_back([this, i]()
+                                   { workerLoop(i); });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard lock(m_wake_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto &worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    std::size_t ThreadPool::defaultThreadCount()
+    {
+        //! the thread calling parallelFor works too
+        auto hw_count = std::thread::hardware_concurrency();
+        return hw_count > 1 ? hw_count - 1 : 0;
+    }
+
+    std::size_t ThreadPool::threadCount() const
+    {
+        return m_workers.size();
+    }
+
+    void ThreadPool::submit(Task task)
+    {
+        std::size_t queue_i = t_pool == this ? t_worker_i : m_next_queue++ % m_queues.size();
+        {
+            std::lock_guard lock(m_queues[queue_i]->mutex);
+            m_queues[queue_i]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard lock(m_wake_mutex);
+            m_pending_count++;
+        }
+        m_wake.notify_one();
+    }
+
+    bool ThreadPool::popTask(std::size_t queue_i, Task &task)
+    {
+        auto &queue = *m_queues[queue_i];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            return false;
+        }
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        m_pending_count--;
+        return true;
+    }
+
+    bool ThreadPool::stealTask(std::size_t thief_i, Task &task)
+    {
+        for (std::size_t i = 1; i <= m_queues.size(); ++i)
+        {
+            auto &queue = *m_queues[(thief_i + i) % m_queues.size()];
+            std::lock_guard lock(queue.mutex);
+            if (!queue.tasks.empty())
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                m_pending_count--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool ThreadPool::runPendingTask()
+    {
+        Task task;
+        bool is_worker = t_pool == this;
+        if ((is_worker && popTask(t_worker_i, task)) || stealTask(is_worker ? t_worker_i : 0, task))
+        {
+            task();
+            return true;
+        }
+        return false;
+    }
+
+    void ThreadPool::workerLoop(std::size_t worker_i)
+    {
+        t_pool = this;
+        t_worker_i = worker_i;
+        while (true)
+        {
+            if (runPendingTask())
+            {
+                continue;
+            }
+
+            std::unique_lock lock(m_wake_mutex);
+            m_wake.wait(lock, [this]()
+                        { return m_stop || m_pending_count > 0; });
+            if (m_stop)
+            {
+                return;
+            }
+        }
+    }
+
+    void ThreadPool::parallelFor(std::size_t task_count, const std::function<void(std::size_t)> &body)
+    {
+        if (task_count == 0)
+        {
+            return;
+        }
+
+        std::atomic<std::size_t> remaining = task_count;
+        //! the last task is kept for the calling thread
+        for (std::size_t task_i = 0; task_i + 1 < task_count; ++task_i)
+        {
+            submit([&body, &remaining, task_i]()
+                   {
+                       body(task_i);
+                       remaining--; });
+        }
+        body(task_count - 1);
+        remaining--;
+
+        while (remaining > 0)
+        {
+            if (!runPendingTask())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+} // namespace ecs
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+namespace ecs
+{
+
+    //! Pool of worker threads with one task deque per worker.
+    //! Workers take tasks from the back of their own deque and steal from the front of the others when idle.
+    //! Tasks must not throw.
+    class ThreadPool
+    {
+    public:
+        using Task = std::function<void()>;
+
+        //! thread_count of 0 means all tasks get executed by threads waiting in parallelFor
+        explicit ThreadPool(std::size_t thread_count = defaultThreadCount());
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        //! queues the task, tasks submitted from a worker go to its own deque
+        void submit(Task task);
+
+        //! calls body(i) for every i in [0, task_count) and returns when all calls finished
+        //! the calling thread executes tasks too, so it is safe to call from inside of a task
+        void parallelFor(std::size_t task_count, const std::function<void(std::size_t)> &body);
+
+        //! runs one pending task on the calling thread
+        //! \returns false if there was nothing to run
+        bool runPendingTask();
+
+        std::size_t threadCount() const;
+
+        static std::size_t defaultThreadCount();
+
+    private:
+        struct WorkQueue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void workerLoop(std::size_t worker_i);
+        bool popTask(std::size_t queue_i, Task &task);
+        bool stealTask(std::size_t thief_i, Task &task);
+
+        std::vector<std::unique_ptr<WorkQueue>> m_queues; //!< one deque per worker, +1 for tasks from outside when there are no workers
+        std::vector<std::thread> m_workers;
+
+        std::mutex m_wake_mutex;
+        std::condition_variable m_wake;
+        std::atomic<std::size_t> m_pending_count = 0; //!< number of queued tasks
+        std::atomic<std::size_t> m_next_queue = 0;    //!< round robin for tasks submitted from outside of workers
+        bool m_stop = false;
+
+        inline static thread_local const ThreadPool *t_pool = nullptr; //!< pool of the worker running on this thread
+        inline static thread_local std::size_t t_worker_i = 0;          //!< index of the worker running on this thread
+    };
+
+} // namespace ecs
@@ -56,6 +56,16 @@ static void BM_EntityCreation(benchmark::State &state)
 }
 BENCHMARK(BM_EntityCreation)->Range(100, 9999);
 
+static void BM_EntityBulkCreation(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        EntityWorld world;
+        benchmark::DoNotOptimize(world.addEntities(state.range(0), CompA{}, CompB{.x = 5}));
+    }
+}
+BENCHMARK(BM_EntityBulkCreation)->Range(100, 9999);
+
 static void BM_action1(benchmark::State &state)
 {
 
@@ -162,6 +172,35 @@ static void BM_action4(benchmark::State &state)
 }
 BENCHMARK(BM_action4);
 
+static void BM_action4SoA(benchmark::State &state)
+{
+
+    EntityWorld world;
+    world.setLayout<CompA, CompC>(ChunkLayout::SoA);
+
+    for (int i = 0; i <  6000; ++i)
+    {
+        world.addEntity(CompA{.x = rand() % 100, .y = rand() % 500}, CompC{.vx = rand() % 50, .vy = rand() % 69, .max_vel = 100.f});
+    }
+
+    auto action3 = [](CompC &vel)
+    {
+        float speed2 = vel.vx * vel.vx + vel.vy * vel.vy;
+        float ratio = speed2 / (vel.max_vel * vel.max_vel);
+        if (ratio > 1.f)
+        {
+            vel.vx /= std::sqrt(ratio);
+            vel.vy /= std::sqrt(ratio);
+        }
+    };
+
+    for (auto _ : state)
+    {
+        world.forEach(action3);
+    }
+}
+BENCHMARK(BM_action4SoA);
+
 BENCHMARK_MAIN();
 
 // int main(int argc, char **argv)
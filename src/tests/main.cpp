@@ -8,6 +8,7 @@ REGISTER(CompD)
 REGISTER(Tag)
 REGISTER(CompFunction)
 REGISTER(CompSharedPtr)
+REGISTER(Team)
 
 
 
@@ -1,7 +1,11 @@
 #include <gtest/gtest.h>
 
 #include <EntityWorld.h>
+#include <Serialization.h>
+#include <SystemScheduler.h>
 #include <type_traits>
+#include <sstream>
+#include <set>
 
 using namespace ecs;
 
@@ -80,6 +84,55 @@ struct CompSharedPtr : public CompTag<CompSharedPtr>
     int* func;
 }; 
 
+//! components with ids known at compile time, they need no REGISTER
+struct StaticA : public CompTag<StaticA, 1>
+{
+    int a;
+};
+
+struct StaticB : public CompTag<StaticB, 2>
+{
+    double b;
+};
+
+struct StaticTag : public CompTag<StaticTag, 3>
+{};
+
+//! not trivially copyable, so it saves itself
+struct StaticName : public CompTag<StaticName, 4>
+{
+    std::string name;
+
+    void save(std::ostream& os) const
+    {
+        writeRaw<std::uint32_t>(os, name.size());
+        os.write(name.data(), name.size());
+    }
+    void load(std::istream& is)
+    {
+        name.resize(readRaw<std::uint32_t>(is));
+        is.read(name.data(), name.size());
+    }
+};
+
+//! two components claiming the same static id, only one of them may be used
+struct SavedV1 : public CompTag<SavedV1, 14>
+{
+    int x;
+};
+struct SavedV2 : public CompTag<SavedV2, 14>
+{
+    std::int64_t x;
+};
+
+//! one value per chunk
+struct Team : public SharedCompTag<Team>
+{
+    int team;
+    bool operator==(const Team& other) const { return team == other.team; }
+    std::size_t hash() const { return team; }
+};
+
 
 
 
@@ -99,6 +152,669 @@ namespace  //! THIS NAMESPACE NEEDS TO BE ANONYMOUS FOR SOME REASON???
         
     }
     
+    TEST(StaticIds, ComponentTests)
+    {
+        static_assert(StaticA::id == 1 && StaticB::id == 2);
+        EXPECT_GE(CompA::id, FIRST_DYNAMIC_COMPONENT_ID); //! registered ids do not collide with static ones
+        constexpr auto mask = archetypeIdOf<StaticA, StaticB>();
+        EXPECT_EQ(mask, ArchetypeId({1, 2}));
+        //! StaticB has the larger alignment so it goes first
+        static_assert(staticBlockOffsets<StaticA, StaticB>() == std::array<std::size_t, 2>{8, 0});
+
+        EntityWorld world;
+        for(int i = 0; i < 10; ++i)
+        {
+            world.addEntity(StaticA{.a=i}, StaticB{.b=2.0*i});
+            world.addEntity(StaticA{.a=i}, StaticB{.b=2.0*i}, CompC{.x='c'});
+        }
+        auto& archetype = world.m_archetypes.at(mask);
+        EXPECT_EQ((archetype.getOffsets<StaticA, StaticB>()), (staticBlockOffsets<StaticA, StaticB>()));
+
+        //! the exact archetype goes through the constant offsets, the other one through the looked up ones
+        int count = 0;
+        world.forEach([&count](StaticB& b, const StaticA& a)
+        {
+            EXPECT_DOUBLE_EQ(b.b, 2.0*a.a);
+            count++;
+        });
+        EXPECT_EQ(count, 20);
+    }
+
+    TEST(ZeroSizedTags, ComponentTests)
+    {
+        static_assert(TagComponent<Tag> && TagComponent<const Tag> && !TagComponent<CompA>);
+        static_assert(staticBlockOffsets<StaticA, StaticTag>() == std::array<std::size_t, 2>{0, TAG_COLUMN});
+
+        EntityWorld world;
+        auto plain = world.addEntity(CompA{.a=1}, CompFunction{});
+        auto tagged = world.addEntity(CompA{.a=2}, CompFunction{}, Tag{});
+        auto& plain_archetype = world.m_archetypes[plain.archetype];
+        auto& tagged_archetype = world.m_archetypes[tagged.archetype];
+        EXPECT_NE(&plain_archetype, &tagged_archetype);
+        //! tags add nothing to the blocks
+        EXPECT_EQ(tagged_archetype.m_type_info.size(), 2);
+        EXPECT_EQ(tagged_archetype.m_total_size, plain_archetype.m_total_size);
+        EXPECT_TRUE(tagged_archetype.hasComponent(Tag::id));
+        EXPECT_TRUE(world.has<Tag>(tagged.id));
+        EXPECT_FALSE(world.has<Tag>(plain.id));
+
+        //! migrations by tags do not touch the tags, the other components come along
+        world.addComponent(plain.id, Tag{});
+        world.removeComponent<Tag>(tagged.id);
+        EXPECT_TRUE(world.has<Tag>(plain.id));
+        EXPECT_FALSE(world.has<Tag>(tagged.id));
+        EXPECT_EQ(world.get<CompA>(plain.id).a, 1);
+        EXPECT_EQ(world.get<CompA>(tagged.id).a, 2);
+
+        world.commands().addComponent(tagged.id, Tag{});
+        world.commands().addComponent(plain.id, Tag{}); //! already there
+        world.flush();
+        EXPECT_TRUE(world.has<Tag>(tagged.id));
+
+        int count = 0;
+        world.forEach([&count](CompA& a, const Tag& tag)
+        {
+            count++;
+        });
+        EXPECT_EQ(count, 2);
+        world.removeComponent<Tag>(plain.id);
+        int tagged_count = 0;
+        world.forEach([&tagged_count](CompA& a, Tag* tag)
+        {
+            tagged_count += tag != nullptr;
+        });
+        EXPECT_EQ(tagged_count, 1);
+        world.forEachChunk([](std::span<const EntityId> ids, ColumnView<CompA> a, ColumnView<Tag> tags)
+        {
+            EXPECT_EQ(tags.size(), ids.size());
+            EXPECT_EQ(&tags[0], &tags[ids.size() - 1]); //! one shared instance
+        });
+
+        //! static tags do not spoil the constant offsets
+        for(int i = 0; i < 10; ++i)
+        {
+            world.addEntity(StaticA{.a=i}, StaticTag{});
+        }
+        int sum = 0;
+        world.forEach([&sum](StaticA& a, StaticTag& tag)
+        {
+            sum += a.a;
+        });
+        EXPECT_EQ(sum, 45);
+    }
+
+    TEST(SharedComponents, ComponentTests)
+    {
+        static_assert(SharedComponent<Team> && SharedComponent<const Team> && !SharedComponent<CompA>);
+
+        EntityWorld world;
+        std::vector<EntityId> ids;
+        for(int i = 0; i < 300; ++i)
+        {
+            ids.push_back(world.addEntity(CompA{.a=i}, Team{.team=i % 3}).id);
+        }
+        world.addEntities(10, CompA{.a=1}, Team{.team=1});
+
+        //! one archetype per value, the value is not stored in the blocks
+        auto signature = world.getId<CompA, Team>();
+        int group_count = 0;
+        for(auto index = world.m_archetypes.find(signature); index != NO_ARCHETYPE; index = world.m_archetypes.next(index))
+        {
+            EXPECT_EQ(world.m_archetypes[index].m_total_size, sizeof(CompA));
+            group_count++;
+        }
+        EXPECT_EQ(group_count, 3);
+
+        int count = 0;
+        world.forEachChunk([&count](std::span<const EntityId> ids, ColumnView<CompA> a, const Team& team)
+        {
+            for(std::size_t i = 0; i < ids.size(); ++i)
+            {
+                EXPECT_EQ(a[i].a % 3, team.team);
+            }
+            count += ids.size();
+        });
+        EXPECT_EQ(count, 310);
+        EXPECT_EQ(world.get<const Team>(ids[4]).team, 1);
+
+        //! changing the value moves the entity, other migrations keep it
+        world.addComponent(ids[4], Team{.team=2});
+        world.addComponent(ids[5], CompB{.x=1});
+        world.removeComponent<Team>(ids[6]);
+        EXPECT_EQ(world.get<const Team>(ids[4]).team, 2);
+        EXPECT_EQ(world.get<CompA>(ids[4]).a, 4);
+        EXPECT_EQ(world.get<const Team>(ids[5]).team, 2);
+        EXPECT_EQ(world.get<CompA>(ids[5]).a, 5);
+        EXPECT_FALSE(world.has<Team>(ids[6]));
+        EXPECT_EQ(world.get<CompA>(ids[6]).a, 6);
+
+        world.commands().addComponent(ids[6], Team{.team=7});
+        world.commands().addComponent(ids[7], Team{.team=7});
+        world.commands().removeComponent<Team>(ids[8]);
+        world.flush();
+        EXPECT_EQ(world.get<const Team>(ids[6]).team, 7);
+        EXPECT_EQ(world.get<const Team>(ids[7]).team, 7);
+        EXPECT_FALSE(world.has<Team>(ids[8]));
+
+        int team_7 = 0;
+        world.forEachChunk([&team_7](std::span<const EntityId> ids, const Team& team)
+        {
+            team_7 += team.team == 7 ? ids.size() : 0;
+        });
+        EXPECT_EQ(team_7, 2);
+
+        //! archetypes of a value are looked up by hash, not by walking all archetypes with the signature
+        for(int team = 0; team < 2000; ++team)
+        {
+            world.addEntity(CompB{.x=1}, Team{.team=team});
+        }
+        auto index = world.m_archetypes.find(world.getId<CompB, Team>(), {Archetype::SharedValue::of(Team{.team=1234})});
+        ASSERT_NE(index, NO_ARCHETYPE);
+        EXPECT_EQ(world.m_archetypes[index].getShared<Team>().team, 1234);
+        EXPECT_EQ(world.m_archetypes.find(world.getId<CompB, Team>(), {Archetype::SharedValue::of(Team{.team=2000})}), NO_ARCHETYPE);
+    }
+
+    TEST(SaveLoad, ComponentTests)
+    {
+        ComponentRegistry::add<CompA, CompB, CompD, Tag, StaticName, Team>();
+
+        EntityWorld world;
+        world.setLayout<CompD>(ChunkLayout::SoA);
+        std::vector<EntityId> ids;
+        for(int i = 0; i < 30000; ++i)
+        {
+            switch(i % 4)
+            {
+                case 0: ids.push_back(world.addEntity(CompA{.a=i}, CompB{.x=0.5*i}).id); break;
+                case 1: ids.push_back(world.addEntity(CompA{.a=i}, StaticName{.name=std::to_string(i)}, Tag{}).id); break;
+                case 2: ids.push_back(world.addEntity(CompD{.x=i, .y=-i}).id); break;
+                case 3: ids.push_back(world.addEntity(CompA{.a=i}, Team{.team=i % 7}).id); break;
+            }
+        }
+        for(int i = 0; i < 30000; i += 5)
+        {
+            world.removeEntity(ids[i]);
+        }
+        world.advanceTick();
+
+        std::stringstream stream;
+        world.save(stream);
+        EntityWorld loaded;
+        loaded.load(stream);
+
+        EXPECT_EQ(loaded.tick(), world.tick());
+        EXPECT_EQ(loaded.entityCount(), world.entityCount());
+        EXPECT_EQ(loaded.m_archetypes.size(), world.m_archetypes.size());
+        for(int i = 0; i < 30000; ++i)
+        {
+            if(i % 5 == 0)
+            {
+                EXPECT_FALSE(loaded.contains(ids[i]));
+                continue;
+            }
+            switch(i % 4)
+            {
+                case 0: EXPECT_FLOAT_EQ(loaded.get<CompB>(ids[i]).x, 0.5*i); break;
+                case 1: EXPECT_EQ(loaded.get<StaticName>(ids[i]).name, std::to_string(i)); EXPECT_TRUE(loaded.has<Tag>(ids[i])); break;
+                case 2: EXPECT_EQ(loaded.get<CompD>(ids[i]).y, -i); break;
+                case 3: EXPECT_EQ(loaded.get<const Team>(ids[i]).team, i % 7); break;
+            }
+            if(i % 4 != 2)
+            {
+                EXPECT_EQ(loaded.get<CompA>(ids[i]).a, i);
+            }
+        }
+
+        //! the loaded world keeps working, removed handles are not reused
+        auto new_id = loaded.addEntity(CompA{.a=-1}).id;
+        EXPECT_NE(new_id, ids[0]);
+        loaded.addComponent(ids[1], CompB{.x=1});
+        EXPECT_EQ(loaded.get<StaticName>(ids[1]).name, "1");
+        int count = 0;
+        loaded.forEach([&count](CompA& a)
+        {
+            count++;
+        });
+        EXPECT_EQ(count, 30000 * 3 / 4 - 30000 / 5 * 3 / 4 + 1);
+
+        EXPECT_THROW(loaded.load(stream), std::logic_error);
+        std::stringstream truncated(stream.str().substr(0, 20));
+        EntityWorld broken;
+        EXPECT_THROW(broken.load(truncated), std::runtime_error);
+        //! worlds left half loaded can still be destroyed
+        for(auto cut : {0.3, 0.5, 0.9})
+        {
+            std::stringstream half(stream.str().substr(0, stream.str().size() * cut));
+            EntityWorld half_loaded;
+            EXPECT_THROW(half_loaded.load(half), std::runtime_error);
+        }
+
+        //! snapshots contain only component bytes, not what chunks held before or padding between columns
+        auto snapshot_of = [](int stale)
+        {
+            EntityWorld fresh;
+            fresh.setLayout<CompD>(ChunkLayout::SoA);
+            //! leaves chunks filled with values which differ between the calls
+            std::vector<EntityId> removed;
+            for(int i = 0; i < 20000; ++i)
+            {
+                removed.push_back(fresh.addEntity(CompD{.x=stale, .y=stale}).id);
+                removed.push_back(fresh.addEntity(CompC{.x=char(stale)}, CompB{.x=double(stale)}).id);
+            }
+            for(auto id : removed)
+            {
+                fresh.removeEntity(id);
+            }
+            fresh.addEntity(CompD{.x=1, .y=2});
+            fresh.addEntity(CompC{.x='c'}, CompB{.x=3});
+            std::stringstream snapshot;
+            fresh.save(snapshot);
+            return snapshot.str();
+        };
+        auto clean_snapshot = snapshot_of(0);
+        EXPECT_EQ(snapshot_of(-1), clean_snapshot);
+
+        //! components whose layout changed since saving are rejected instead of being read as garbage
+        //! a build in which SavedV1 had 8 bytes is simulated by patching its size in the archetype header
+        ComponentRegistry::add<SavedV1>();
+        EntityWorld old_build;
+        old_build.addEntity(SavedV1{.x=1});
+        std::stringstream old_snapshot;
+        old_build.save(old_snapshot);
+        std::string type_header(20, '\0'); //! id, size and alignment
+        type_header[0] = SavedV1::id;
+        type_header[4] = sizeof(SavedV1);
+        type_header[12] = alignof(SavedV1);
+        auto bytes = old_snapshot.str();
+        auto header_pos = bytes.find(type_header);
+        ASSERT_NE(header_pos, std::string::npos);
+        bytes[header_pos + 4] = 8;
+        std::stringstream patched(bytes);
+        EntityWorld new_build;
+        EXPECT_THROW(new_build.load(patched), std::runtime_error);
+
+        //! ids claimed twice are rejected, the columns of both components would alias
+        ComponentRegistry::add<SavedV1>();
+        EXPECT_THROW(ComponentRegistry::add<SavedV2>(), std::logic_error);
+        static_assert(!distinctStaticIds<SavedV1, CompA, SavedV2>());
+        static_assert(distinctStaticIds<SavedV1, CompA, StaticA>());
+    }
+
+    TEST(DeltaReplication, ComponentTests)
+    {
+        ComponentRegistry::add<CompA, CompB, CompC, CompD, Tag, StaticName, Team>();
+
+        EntityWorld world;
+        world.setLayout<CompD>(ChunkLayout::SoA);
+        std::stringstream unlogged;
+        EXPECT_THROW(world.saveDelta(unlogged, 0), std::logic_error);
+        world.enableDeltas();
+        EntityWorld mirror;
+        std::stringstream pipe; //! stands in for a pipe into the process of the mirror
+        Tick since = 0;
+        auto replicate = [&]
+        {
+            auto begin = pipe.tellp();
+            world.saveDelta(pipe, since);
+            since = world.advanceTick();
+            mirror.applyDelta(pipe);
+            return static_cast<std::size_t>(pipe.tellp() - begin);
+        };
+
+        std::vector<EntityId> ids;
+        auto expect_same = [&]
+        {
+            EXPECT_EQ(mirror.entityCount(), world.entityCount());
+            EXPECT_EQ(mirror.tick() + 1, world.tick());
+            for(auto id : ids)
+            {
+                ASSERT_EQ(mirror.contains(id), world.contains(id));
+                if(!world.contains(id))
+                {
+                    continue;
+                }
+                EXPECT_EQ(mirror.has<Tag>(id), world.has<Tag>(id));
+                auto expect_equal = [&]<class Comp>(auto member)
+                {
+                    ASSERT_EQ(mirror.has<Comp>(id), world.has<Comp>(id));
+                    if(world.has<Comp>(id))
+                    {
+                        EXPECT_EQ(mirror.get<const Comp>(id).*member, world.get<const Comp>(id).*member);
+                    }
+                };
+                expect_equal.operator()<CompA>(&CompA::a);
+                expect_equal.operator()<CompB>(&CompB::x);
+                expect_equal.operator()<CompC>(&CompC::x);
+                expect_equal.operator()<CompD>(&CompD::y);
+                expect_equal.operator()<StaticName>(&StaticName::name);
+                expect_equal.operator()<Team>(&Team::team);
+            }
+        };
+
+        for(int i = 0; i < 20000; ++i)
+        {
+            switch(i % 4)
+            {
+                case 0: ids.push_back(world.addEntity(CompA{.a=i}, CompB{.x=0.5*i}).id); break;
+                case 1: ids.push_back(world.addEntity(CompA{.a=i}, StaticName{.name=std::to_string(i)}, Tag{}).id); break;
+                case 2: ids.push_back(world.addEntity(CompD{.x=i, .y=-i}).id); break;
+                case 3: ids.push_back(world.addEntity(CompA{.a=i}, Team{.team=i % 7}).id); break;
+            }
+        }
+        auto full_size = replicate();
+        expect_same();
+
+        //! removals, migrations, changes of shared values and value edits
+        for(int i = 0; i < 20000; ++i)
+        {
+            auto id = ids[i];
+            switch(i % 10)
+            {
+                case 0: world.removeEntity(id); break;
+                case 1: world.addComponent(id, CompC{.x='c'}); break;
+                case 2: world.removeComponent<CompB>(id); break;
+                case 3: world.addComponent(id, Team{.team=100}); break;
+                case 4: world.has<CompA>(id) ? void(world.get<CompA>(id).a = -i) : void(world.get<CompD>(id).y = i); break;
+                case 5: world.has<StaticName>(id) ? void(world.get<StaticName>(id).name += "!") : world.addComponent(id, Tag{}); break;
+            }
+        }
+        for(int i = 0; i < 1000; ++i) //! reuses indices of the removed entities
+        {
+            ids.push_back(world.addEntity(CompA{.a=100000 + i}, CompC{.x='n'}).id);
+        }
+        replicate();
+        expect_same();
+
+        //! only one column of one archetype gets written
+        world.forEach([](CompD& d)
+        {
+            d.y *= 2;
+        });
+        auto small_size = replicate();
+        expect_same();
+        EXPECT_LT(small_size * 4, full_size);
+
+        //! nothing happened
+        EXPECT_LT(replicate(), 100);
+        expect_same();
+
+        std::stringstream truncated;
+        world.saveDelta(truncated, 0);
+        std::stringstream cut(truncated.str().substr(0, truncated.str().size() / 2));
+        EntityWorld broken;
+        EXPECT_THROW(broken.applyDelta(cut), std::runtime_error);
+
+        //! a mirror which got only entities of later pages can be saved and loaded
+        EntityWorld sparse;
+        sparse.enableDeltas();
+        std::vector<EntityId> sparse_ids;
+        for(int i = 0; i < 5000; ++i)
+        {
+            sparse_ids.push_back(sparse.addEntity(CompA{.a=i}).id);
+        }
+        for(int i = 0; i < ENTITY_PAGE_SIZE; ++i)
+        {
+            sparse.removeEntity(sparse_ids[i]);
+        }
+        std::stringstream sparse_delta;
+        sparse.saveDelta(sparse_delta, 0);
+        EntityWorld sparse_mirror;
+        sparse_mirror.applyDelta(sparse_delta);
+        std::stringstream sparse_snapshot;
+        sparse_mirror.save(sparse_snapshot);
+        EntityWorld sparse_loaded;
+        sparse_loaded.load(sparse_snapshot);
+        EXPECT_EQ(sparse_loaded.entityCount(), 5000 - ENTITY_PAGE_SIZE);
+        for(int i = ENTITY_PAGE_SIZE; i < 5000; ++i)
+        {
+            EXPECT_EQ(sparse_loaded.get<CompA>(sparse_ids[i]).a, i);
+        }
+        sparse_loaded.addEntity(CompA{.a=-1});
+        EXPECT_EQ(sparse_loaded.entityCount(), 5001 - ENTITY_PAGE_SIZE);
+
+        //! removals are logged only for worlds sending deltas, and only until the mirrors got them
+        EntityWorld churn;
+        for(int i = 0; i < 10000; ++i)
+        {
+            churn.removeEntity(churn.addEntity(CompA{.a=i}).id);
+        }
+        EXPECT_EQ(churn.removalLogSize(), 0);
+        churn.enableDeltas();
+        Tick churn_since = 0;
+        for(int frame = 0; frame < 100; ++frame)
+        {
+            for(int i = 0; i < 100; ++i)
+            {
+                churn.removeEntity(churn.addEntity(CompA{.a=i}).id);
+            }
+            std::stringstream delta;
+            churn.saveDelta(delta, churn_since);
+            churn_since = churn.advanceTick();
+            churn.discardRemovalsBefore(churn_since);
+            EXPECT_EQ(churn.removalLogSize(), 0);
+        }
+    }
+
+    TEST(ForkCopyOnWrite, ComponentTests)
+    {
+        auto world = std::make_unique<EntityWorld>();
+        std::vector<EntityId> ids;
+        for(int i = 0; i < 30000; ++i)
+        {
+            ids.push_back(i % 3 == 0 ? world->addEntity(CompA{.a=i}, StaticName{.name=std::to_string(i)}).id
+                                     : world->addEntity(CompA{.a=i}, CompB{.x=0.5*i}).id);
+        }
+        auto first = ids[1];
+        auto last = ids[29999];
+
+        auto forked = world->fork();
+        EXPECT_EQ(forked->entityCount(), world->entityCount());
+        EXPECT_EQ(forked->tick(), world->tick());
+        //! trivially copyable chunks are shared until written, read only access keeps them shared
+        int sum = 0;
+        forked->forEach([&sum](const CompA& a, const CompB& b)
+        {
+            sum += a.a;
+        });
+        EXPECT_EQ(&forked->get<const CompB>(first), &world->get<const CompB>(first));
+        EXPECT_NE(&forked->get<const StaticName>(ids[0]), &world->get<const StaticName>(ids[0]));
+
+        //! writes and structural changes copy the chunks in the world doing them
+        forked->get<CompB>(first).x = -1;
+        EXPECT_NE(&forked->get<const CompB>(first), &world->get<const CompB>(first));
+        EXPECT_EQ(&forked->get<const CompB>(last), &world->get<const CompB>(last)); //! other chunks stay shared
+        //! moving the last block out of an archetype only reads its chunk, which stays shared
+        forked->addComponent(last, Tag{});
+        EXPECT_EQ(&forked->get<const CompB>(ids[29998]), &world->get<const CompB>(ids[29998]));
+        forked->forEach([](StaticName& name)
+        {
+            name.name += "!";
+        });
+        forked->addComponent(ids[2], CompC{.x='c'});
+        forked->removeEntity(ids[4]);
+        world->get<CompB>(last).x = -2;
+
+        EXPECT_FLOAT_EQ(world->get<CompB>(first).x, 0.5);
+        EXPECT_FLOAT_EQ(forked->get<CompB>(first).x, -1);
+        EXPECT_FLOAT_EQ(world->get<CompB>(last).x, -2);
+        EXPECT_FLOAT_EQ(forked->get<CompB>(last).x, 0.5*29999);
+        EXPECT_EQ(world->get<StaticName>(ids[0]).name, "0");
+        EXPECT_EQ(forked->get<StaticName>(ids[0]).name, "0!");
+        EXPECT_FALSE(world->has<CompC>(ids[2]));
+        EXPECT_TRUE(forked->has<CompC>(ids[2]));
+        EXPECT_TRUE(world->contains(ids[4]));
+        EXPECT_FALSE(forked->contains(ids[4]));
+
+        //! forks outlive their parent and can be forked again
+        auto forked_again = forked->fork();
+        world.reset();
+        forked.reset();
+        int count = 0;
+        forked_again->forEach([&](CompA& a)
+        {
+            count++;
+        });
+        EXPECT_EQ(count, 29999);
+        EXPECT_FLOAT_EQ(forked_again->get<CompB>(first).x, -1);
+        EXPECT_EQ(forked_again->get<CompC>(ids[2]).x, 'c');
+        EXPECT_EQ(forked_again->get<StaticName>(ids[3]).name, "3!");
+        EXPECT_EQ(forked_again->get<CompA>(last).a, 29999);
+    }
+
+    TEST(SparseArchetypeId, ComponentTests)
+    {
+        ArchetypeId small{3, 1, 600};
+        EXPECT_EQ(small.count(), 3);
+        EXPECT_TRUE(small.test(600));
+        EXPECT_FALSE(small.test(64 + 1)); //! same summary bit as 1
+        EXPECT_EQ(small.ids()[0], 1);
+        EXPECT_EQ(small.ids()[2], 600);
+
+        //! grows past the inline storage and back, order of insertion does not matter
+        ArchetypeId big;
+        ArchetypeId big_reversed;
+        for(int i = 0; i < 40; ++i)
+        {
+            big.set(i * 97);
+            big_reversed.set((39 - i) * 97);
+        }
+        EXPECT_EQ(big, big_reversed);
+        EXPECT_EQ(std::hash<ArchetypeId>{}(big), std::hash<ArchetypeId>{}(big_reversed));
+        EXPECT_TRUE(std::is_sorted(big.ids().begin(), big.ids().end()));
+        EXPECT_TRUE(ArchetypeId({97, 970}) <= big);
+        EXPECT_FALSE(ArchetypeId({97, 971}) <= big);
+        EXPECT_FALSE(big <= ArchetypeId({97, 970}));
+        EXPECT_TRUE(big.intersects(ArchetypeId({5, 194})));
+        EXPECT_FALSE(big.intersects(ArchetypeId({5, 195})));
+
+        for(int i = 1; i < 40; ++i)
+        {
+            big.reset(i * 97);
+        }
+        EXPECT_EQ(big, ArchetypeId({0}));
+        EXPECT_FALSE(big == ArchetypeId{});
+    }
+
+    TEST(ArchetypeTableLookup, ComponentTests)
+    {
+        ArchetypeTable table;
+        std::vector<Archetype*> addresses;
+        for(int i = 0; i < 100; ++i)
+        {
+            auto index = table.create(ArchetypeId({i, i + 100}));
+            EXPECT_EQ(index, i); //! indices are dense
+            addresses.push_back(&table[index]);
+        }
+        for(int i = 0; i < 100; ++i)
+        {
+            EXPECT_EQ(table.find(ArchetypeId({i + 100, i})), i);
+            EXPECT_EQ(&table[i], addresses[i]); //! archetypes stay in place while the table grows
+            EXPECT_EQ(table.signature(i), ArchetypeId({i, i + 100}));
+        }
+        EXPECT_EQ(table.find(ArchetypeId({0, 101})), NO_ARCHETYPE);
+        EXPECT_THROW(table.at(ArchetypeId({7})), std::out_of_range);
+
+        //! entity records hold the dense index of their archetype
+        EntityWorld world;
+        auto e0 = world.addEntity(CompA{.a=1});
+        auto e1 = world.addEntity(CompA{.a=2}, CompB{.x=1});
+        EXPECT_EQ(e0.archetype, 0);
+        EXPECT_EQ(e1.archetype, 1);
+        EXPECT_EQ(&world.m_archetypes[e1.archetype], &world.m_archetypes.at(world.getId<CompA, CompB>()));
+    }
+
+    TEST(EntityLocations, ComponentTests)
+    {
+        EntityWorld world;
+        std::vector<EntityId> ids;
+        for(int i = 0; i < 20000; ++i) //! several chunks
+        {
+            ids.push_back(world.addEntity(CompA{.a=i}, CompB{.x=2.0*i}).id);
+        }
+        auto more_ids = world.addEntities(5000, CompA{.a=-1}, CompB{.x=-1});
+
+        //! every removal swaps the last block into the hole, every migration moves blocks between archetypes
+        auto& commands = world.commands();
+        for(int i = 0; i < 20000; ++i)
+        {
+            if(i % 5 == 0)
+            {
+                world.removeEntity(ids[i]);
+            }
+            else if(i % 5 == 1)
+            {
+                world.addComponent(ids[i], CompC{.x='c'});
+            }
+            else if(i % 5 == 2)
+            {
+                commands.addComponent(ids[i], CompC{.x='d'});
+            }
+            else if(i % 5 == 3)
+            {
+                world.removeComponent<CompB>(ids[i]);
+            }
+        }
+        world.flush();
+
+        for(int i = 0; i < 20000; ++i)
+        {
+            if(i % 5 == 0)
+            {
+                EXPECT_FALSE(world.contains(ids[i]));
+                continue;
+            }
+            EXPECT_EQ(world.get<CompA>(ids[i]).a, i);
+            EXPECT_EQ(world.has<CompB>(ids[i]), i % 5 != 3);
+            if(i % 5 != 3)
+            {
+                EXPECT_FLOAT_EQ(world.get<const CompB>(ids[i]).x, 2.0*i);
+            }
+            if(i % 5 == 1 || i % 5 == 2)
+            {
+                EXPECT_EQ(world.get<CompC>(ids[i]).x, i % 5 == 1 ? 'c' : 'd');
+            }
+        }
+        for(auto id : more_ids)
+        {
+            EXPECT_EQ(world.get<CompA>(id).a, -1);
+        }
+
+        //! the entity ids stored with the blocks agree with the locations
+        world.forEachChunk([&](std::span<const EntityId> chunk_ids, ColumnView<CompA> a)
+        {
+            for(std::size_t i = 0; i < chunk_ids.size(); ++i)
+            {
+                EXPECT_EQ(&world.get<CompA>(chunk_ids[i]), &a[i]);
+            }
+        });
+    }
+
+    TEST(TrivialTypeInfo, ComponentTests)
+    {
+        EXPECT_TRUE(CompTypeInfo{CompA{}}.trivially_copyable);
+        EXPECT_TRUE(CompTypeInfo{CompD{}}.trivially_destructible);
+        EXPECT_FALSE(CompTypeInfo{CompFunction{}}.trivially_copyable);
+        EXPECT_FALSE(CompTypeInfo{CompFunction{}}.trivially_destructible);
+
+        //! swap-remove in POD only archetype moves whole blocks
+        EntityWorld world;
+        std::vector<EntityId> ids;
+        for(int i = 0; i < 100; ++i)
+        {
+            ids.push_back(world.addEntity(CompA{.a=i}, CompB{.x=2.0*i}, CompD{.x=i, .y=-i}).id);
+        }
+        for(int i = 0; i < 100; i += 3)
+        {
+            world.removeEntity(ids[i]);
+        }
+        world.removeComponent<CompB>(ids[1]);
+        for(int i = 1; i < 100; i += 3)
+        {
+            EXPECT_EQ(world.get<CompA>(ids[i]).a, i);
+            EXPECT_EQ(world.get<CompD>(ids[i]).y, -i);
+        }
+    }
+
     TEST(EntityInsertion, BasicTests)
     {
         EntityWorld world;
@@ -115,19 +831,42 @@ namespace  //! THIS NAMESPACE NEEDS TO BE ANONYMOUS FOR SOME REASON???
         
         world.removeEntity(e1.id);
         auto e4 = world.addEntity(CompC{}, CompA{});
-        EXPECT_EQ(e4.id, e1.id); //! deleted id should have been used
+        EXPECT_EQ(entityIndex(e4.id), entityIndex(e1.id)); //! deleted id should have been used
+        EXPECT_NE(e4.id, e1.id); //! but with new generation
         
         auto e5 = world.addEntity(CompA{});
         EXPECT_EQ(e5.id, 4); //! deleted id should have been used
         
         auto ex = world.addEntity(CompSharedPtr{});
     }
+    TEST(StaleHandles, BasicTests)
+    {
+        EntityWorld world;
+
+        auto e0 = world.addEntity(CompA{.a=1});
+        world.removeEntity(e0.id);
+        EXPECT_FALSE(world.contains(e0.id));
+        EXPECT_THROW(world.get<CompA>(e0.id), std::out_of_range);
+        EXPECT_THROW(world.removeEntity(e0.id), std::out_of_range);
+
+        auto e1 = world.addEntity(CompA{.a=2});
+        EXPECT_TRUE(world.contains(e1.id));
+        EXPECT_FALSE(world.contains(e0.id)); //! the old handle does not alias the new entity
+        EXPECT_EQ(world.get<CompA>(e1.id).a, 2);
+
+        //! more entities than fit into one page
+        for(int i = 0; i < 3 * ENTITY_PAGE_SIZE; ++i)
+        {
+            world.addEntity(CompB{.x=1});
+        }
+        EXPECT_EQ(world.entityCount(), 3 * ENTITY_PAGE_SIZE + 1);
+    }
     TEST(EntityInsertionNewChunk, BasicTests)
     {
         EntityWorld world;
         
         auto e_last = world.addEntity(CompA{.a=5}, CompB{.x=69}, CompC{.x='6'});
-        auto& archetype = world.m_archetypes.at(e_last.comp_ids);
+        auto& archetype = world.m_archetypes[e_last.archetype];
         
         EXPECT_EQ(archetype.chunkCount(), 1);
         
@@ -142,6 +881,163 @@ namespace  //! THIS NAMESPACE NEEDS TO BE ANONYMOUS FOR SOME REASON???
         EXPECT_EQ(world.get<CompA>(e_last.id).a, 5);
     }
     
+    TEST(SoAInsertionDeletion, LayoutTests)
+    {
+        EntityWorld world;
+        world.setDefaultLayout(ChunkLayout::SoA);
+
+        std::vector<Entity> entities;
+        for(int i = 0; i <= COMPONENT_CHUNK_SIZE / 8; ++i)
+        {
+            entities.push_back(world.addEntity(CompA{.a=i}, CompB{.x=2}, CompC{.x='c'}));
+        }
+        auto& archetype = world.m_archetypes[entities.back().archetype];
+        EXPECT_EQ(archetype.layout(), ChunkLayout::SoA);
+        EXPECT_EQ(archetype.chunkCount(), 2);
+
+        //! columns are contiguous and aligned
+        auto* a0 = &world.get<CompA>(entities[0].id);
+        auto* a1 = &world.get<CompA>(entities[1].id);
+        EXPECT_EQ(reinterpret_cast<std::byte*>(a1) - reinterpret_cast<std::byte*>(a0), sizeof(CompA));
+
+        world.removeEntity(entities[0].id);
+        EXPECT_EQ(world.get<CompA>(entities.back().id).a, COMPONENT_CHUNK_SIZE / 8);
+        EXPECT_EQ(world.get<CompA>(entities[1].id).a, 1);
+
+        world.addComponent(entities[1].id, CompD{.x = 3, .y = 4});
+        EXPECT_EQ(world.get<CompD>(entities[1].id).y, 4);
+        EXPECT_EQ(world.get<CompA>(entities[1].id).a, 1);
+        world.removeComponent<CompB>(entities[1].id);
+        EXPECT_EQ(world.get<CompC>(entities[1].id).x, 'c');
+
+        int call_count = 0;
+        world.forEach([&call_count](CompA& a, CompC& c)
+        {
+            EXPECT_EQ(c.x, 'c');
+            call_count++;
+        });
+        EXPECT_EQ(call_count, entities.size() - 1);
+    }
+
+    TEST(BulkInsertion, BasicTests)
+    {
+        EntityWorld world;
+
+        auto e0 = world.addEntity(CompA{.a=1}, CompFunction{});
+        const int entity_count = 3 * COMPONENT_CHUNK_SIZE / 32;
+        CompFunction function_comp;
+        function_comp.func = [](int i){return 2 * i;};
+        auto ids = world.addEntities(entity_count, CompA{.a=7}, function_comp);
+        EXPECT_EQ(ids.size(), entity_count);
+        EXPECT_EQ(CompFunction::CompFunctionCount, entity_count + 2);
+
+        std::unordered_set<EntityId> unique_ids(ids.begin(), ids.end());
+        EXPECT_EQ(unique_ids.size(), entity_count);
+        EXPECT_FALSE(unique_ids.contains(e0.id));
+
+        EXPECT_EQ(world.get<CompA>(ids.back()).a, 7);
+        EXPECT_EQ(world.get<CompFunction>(ids.back()).func(3), 6);
+        EXPECT_EQ(world.get<CompA>(e0.id).a, 1);
+
+        int call_count = 0;
+        world.forEach([&call_count](CompA& a, CompFunction& f){call_count++;});
+        EXPECT_EQ(call_count, entity_count + 1);
+
+        //! regular insertion continues after the bulk
+        auto e1 = world.addEntity(CompA{.a=2}, CompFunction{});
+        EXPECT_EQ(world.get<CompA>(e1.id).a, 2);
+        world.removeEntity(ids.front());
+        EXPECT_EQ(world.get<CompA>(e1.id).a, 2);
+
+        ids = world.addEntities(10, CompA{.a=3}, function_comp);
+        for(auto id : ids)
+        {
+            world.removeEntity(id);
+        }
+        EXPECT_EQ(world.entityCount(), entity_count + 1);
+
+        //! every entity gets its own values, across chunks and in SoA layout
+        world.setLayout<CompB, CompD>(ChunkLayout::SoA);
+        for(auto init_layout : {0, 1})
+        {
+            std::vector<EntityId> init_ids;
+            if(init_layout == 0)
+            {
+                init_ids = world.addEntities(entity_count, [](std::size_t i, CompA& a, const Tag&, CompB& b)
+                {
+                    a.a = i;
+                    b.x = 0.5 * i;
+                }, CompA{.a=-1}, Tag{}, CompB{});
+            }
+            else
+            {
+                init_ids = world.addEntities(entity_count, [](std::size_t i, CompA& a, CompB& b)
+                {
+                    a.a = i;
+                    b.x = 0.5 * i;
+                }, CompA{.a=-1}, CompB{});
+            }
+            for(int i = 0; i < entity_count; ++i)
+            {
+                EXPECT_EQ(world.get<CompA>(init_ids[i]).a, i);
+                EXPECT_FLOAT_EQ(world.get<CompB>(init_ids[i]).x, 0.5 * i);
+            }
+        }
+        auto teams = world.addEntities(100, [](std::size_t i, CompA& a, const Team& team)
+        {
+            a.a = team.team * 1000 + i;
+        }, CompA{}, Team{.team=5});
+        EXPECT_EQ(world.get<CompA>(teams[42]).a, 5042);
+    }
+
+    TEST(ChunkAlignment, LayoutTests)
+    {
+        for(auto backing : {ChunkBacking::Heap, ChunkBacking::HugePages})
+        {
+            EntityWorld world(backing);
+            world.setLayout<CompA, CompB, CompC>(ChunkLayout::SoA);
+
+            auto ids = world.addEntities(3 * COMPONENT_CHUNK_SIZE / 8, CompA{.a=1}, CompB{.x=2}, CompC{.x='c'});
+            world.forEachChunk([](std::span<const EntityId> ids, ColumnView<CompC> c, ColumnView<CompB> b)
+            {
+                EXPECT_EQ(reinterpret_cast<std::uintptr_t>(c.data()) % CHUNK_ALIGNMENT, 0);
+                EXPECT_EQ(reinterpret_cast<std::uintptr_t>(b.data()) % CHUNK_ALIGNMENT, 0);
+            });
+            EXPECT_EQ(world.get<CompC>(ids.back()).x, 'c');
+            EXPECT_EQ(world.get<CompB>(ids.front()).x, 2);
+        }
+
+        ChunkPool pool(1000);
+        auto chunk = pool.allocate();
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(chunk) % CHUNK_ALIGNMENT, 0);
+        pool.release(chunk);
+        EXPECT_EQ(pool.cachedCount(), 1);
+        EXPECT_EQ(pool.allocate(), chunk); //! released chunks get reused
+        pool.release(chunk);
+        EXPECT_EQ(pool.trim(), pool.chunkSize());
+    }
+
+    TEST(ChunkRelease, LayoutTests)
+    {
+        EntityWorld world;
+
+        auto ids = world.addEntities(5 * COMPONENT_CHUNK_SIZE / 16, CompA{.a=1}, CompB{.x=2});
+        auto& archetype = world.m_archetypes.at(world.getId<CompA, CompB>());
+        EXPECT_EQ(archetype.chunkCount(), 5);
+
+        for(std::size_t i = ids.size() / 5; i < ids.size(); ++i)
+        {
+            world.removeEntity(ids[i]);
+        }
+        EXPECT_EQ(archetype.usedChunkCount(), 1);
+        EXPECT_EQ(archetype.chunkCount(), 2); //! one spare chunk is kept
+
+        EXPECT_GE(world.compact(), 2 * COMPONENT_CHUNK_SIZE);
+        EXPECT_EQ(archetype.chunkCount(), 1);
+        EXPECT_EQ(world.get<CompA>(ids.front()).a, 1);
+        EXPECT_EQ(world.compact(), 0);
+    }
+
     TEST(ComponentInsertion, ComponentTests)
     {
         EntityWorld world;
@@ -209,6 +1105,109 @@ namespace  //! THIS NAMESPACE NEEDS TO BE ANONYMOUS FOR SOME REASON???
     }
 
 
+    TEST(ArchetypeEdges, ComponentTests)
+    {
+        EntityWorld world;
+
+        auto e0 = world.addEntity(CompA{.a=1}, CompC{.x='c'});
+        auto e1 = world.addEntity(CompA{.a=2}, CompC{.x='d'});
+        auto& ac = world.m_archetypes[e0.archetype];
+
+        world.addComponent(e0.id, CompB{.x=3});
+        ASSERT_TRUE(ac.m_add_edges.contains(CompB::id));
+        auto& abc = *ac.m_add_edges.at(CompB::id).target;
+        EXPECT_EQ(abc.m_remove_edges.at(CompB::id).target, &ac); //! both directions are cached
+        EXPECT_EQ(ac.m_add_edges.at(CompB::id).transfers.size(), 2);
+
+        //! toggling reuses the cached edges
+        for(int i = 0; i < 10; ++i)
+        {
+            world.addComponent(e1.id, CompB{.x=4});
+            world.removeComponent<CompB>(e1.id);
+        }
+        EXPECT_FALSE(world.has<CompB>(e1.id));
+        EXPECT_EQ(world.get<CompA>(e1.id).a, 2);
+        EXPECT_EQ(world.get<CompC>(e1.id).x, 'd');
+        EXPECT_EQ(world.get<CompB>(e0.id).x, 3);
+        EXPECT_EQ(world.m_archetypes.size(), 2);
+    }
+
+    TEST(DeferredCommands, ComponentTests)
+    {
+        EntityWorld world;
+
+        std::vector<EntityId> ids;
+        for(int i = 0; i < 100; ++i)
+        {
+            ids.push_back(world.addEntity(CompA{.a=i}, CompC{.x='c'}).id);
+        }
+
+        //! recording inside of an iteration does not change the world
+        auto& commands = world.commands();
+        world.forEachChunk([&](std::span<const EntityId> chunk_ids, ColumnView<CompA> a)
+        {
+            for(std::size_t i = 0; i < chunk_ids.size(); ++i)
+            {
+                if(a[i].a % 2 == 0)
+                {
+                    commands.addComponent(chunk_ids[i], CompB{.x=(float)a[i].a});
+                }
+                else if(a[i].a % 3 == 0)
+                {
+                    commands.removeEntity(chunk_ids[i]);
+                }
+            }
+        });
+        commands.addEntity(CompA{.a=-1});
+        EXPECT_EQ(world.entityCount(), 100);
+        EXPECT_FALSE(world.has<CompB>(ids[0]));
+
+        world.flush();
+        EXPECT_TRUE(commands.empty());
+        EXPECT_EQ(world.entityCount(), 100 - 17 + 1);
+        for(int i = 0; i < 100; ++i)
+        {
+            EXPECT_EQ(world.contains(ids[i]), i % 2 == 0 || i % 3 != 0);
+            if(i % 2 == 0)
+            {
+                EXPECT_FLOAT_EQ(world.get<CompB>(ids[i]).x, i);
+                EXPECT_EQ(world.get<CompA>(ids[i]).a, i);
+                EXPECT_EQ(world.get<CompC>(ids[i]).x, 'c');
+            }
+        }
+
+        //! commands on one entity keep their order, later commands see the effects of earlier ones
+        commands.removeComponent<CompB>(ids[0]);
+        commands.addComponent(ids[0], CompB{.x=7});
+        commands.addComponent(ids[0], CompB{.x=8});
+        commands.addComponent(ids[1], CompB{.x=1});
+        commands.removeEntity(ids[1]);
+        commands.addComponent(ids[1], CompB{.x=2}); //! skipped, entity is gone
+        world.flush();
+        EXPECT_FLOAT_EQ(world.get<CompB>(ids[0]).x, 8);
+        EXPECT_FALSE(world.contains(ids[1]));
+
+        //! each thread keeps its buffer per world, buffers get flushed in the order of their first use
+        EntityWorld other;
+        EXPECT_EQ(&world.commands(), &commands);
+        EXPECT_NE(&other.commands(), &commands);
+        for(int thread_i = 3; thread_i > 0; --thread_i)
+        {
+            std::thread([&world, thread_i]
+            {
+                world.commands().addEntity(CompD{.x=thread_i});
+            }).join();
+        }
+        commands.addEntity(CompD{.x=0});
+        world.flush();
+        std::vector<int> order;
+        world.forEach([&order](const CompD& d)
+        {
+            order.push_back(d.x);
+        });
+        EXPECT_EQ(order, (std::vector<int>{0, 3, 2, 1}));
+    }
+
     TEST(SingleAction, ActionTests)
     {
         EntityWorld world;
@@ -246,6 +1245,333 @@ namespace  //! THIS NAMESPACE NEEDS TO BE ANONYMOUS FOR SOME REASON???
         world.forEach(action2);
         EXPECT_EQ(call_count, 1); //AB and ABC archetypes get used
     }
+    TEST(CachedQuery, ActionTests)
+    {
+        EntityWorld world;
+
+        world.addEntity(CompA{.a=1}, CompB{.x=5});
+        auto& query = world.query<CompA, CompB>();
+        EXPECT_EQ(query.archetypeCount(), 1);
+        auto& same_query = world.query<CompA, CompB>();
+        EXPECT_EQ(&query, &same_query); //! the same query is reused
+
+        auto e1 = world.addEntity(CompA{.a=1}, CompC{.x='C'});
+        EXPECT_EQ(query.archetypeCount(), 1);
+        world.addComponent(e1.id, CompB{.x=5}); //! creates archetype ABC
+        EXPECT_EQ(query.archetypeCount(), 2);
+
+        int call_count = 0;
+        query.forEach([&call_count](CompA& a, CompB& b)
+        {
+            EXPECT_EQ(a.a, 1);
+            EXPECT_FLOAT_EQ(b.x, 5);
+            call_count++;
+        });
+        EXPECT_EQ(call_count, 2);
+    }
+    TEST(ParallelAction, ActionTests)
+    {
+        EntityWorld world;
+        world.setThreadCount(4);
+
+        const int entity_count = 9000;
+        for(int i = 0; i < entity_count; ++i)
+        {
+            world.addEntity(CompA{.a=i}, CompB{.x=1});
+            world.addEntity(CompA{.a=i}, CompC{.x='c'});
+        }
+
+        std::atomic<int> call_count = 0;
+        world.parallelForEach([&call_count](CompA& a)
+        {
+            a.a++;
+            call_count++;
+        });
+        EXPECT_EQ(call_count, 2 * entity_count);
+
+        long long sum = 0;
+        world.forEach([&sum](CompA& a){sum += a.a;});
+        EXPECT_EQ(sum, 2 * ((long long)entity_count * (entity_count + 1) / 2));
+    }
+    TEST(SystemSchedule, ActionTests)
+    {
+        EntityWorld world;
+        world.setThreadCount(4);
+        for(int i = 0; i < 20000; ++i)
+        {
+            world.addEntity(CompA{.a=i}, CompB{.x=1});
+            world.addEntity(CompA{.a=i}, CompC{.x='c'});
+            world.addEntity(CompD{.x=i, .y=0});
+        }
+
+        SystemScheduler scheduler(world);
+        auto twice = scheduler.addSystem("twice", [](CompA& a)
+        {
+            a.a *= 2;
+        });
+        scheduler.addSystem("increment", [](CompA& a)
+        {
+            a.a += 1;
+        });
+        double b_sum = 0;
+        auto sum_b = scheduler.addSystem("sum_b", [&b_sum](const CompB& b)
+        {
+            b_sum += b.x;
+        });
+        auto copy = scheduler.addSystem("copy", [](const CompA& a, CompB& b)
+        {
+            b.x = a.a;
+        });
+        auto move_d = scheduler.addSystem<Without<CompA>>("move_d", [](CompD& d, const CompC* c)
+        {
+            d.y += d.x;
+        });
+        std::size_t count = 0;
+        scheduler.addSystem("count", SystemAccess{.exclusive = true}, [&count](EntityWorld& world)
+        {
+            count = world.entityCount();
+        });
+        //! runs alongside others, so its query is created on registration
+        long long d_sum = 0;
+        auto sum_d = scheduler.addSystem<std::tuple<const CompD, Without<CompA>>>("sum_d", SystemAccess{.reads = world.getId<CompD>()}, [&d_sum](EntityWorld& world)
+        {
+            d_sum = 0;
+            world.forEach<Without<CompA>>([&d_sum](const CompD& d)
+            {
+                d_sum += d.x;
+            });
+        });
+        EXPECT_FALSE(scheduler.access(sum_d).conflicts(scheduler.access(sum_b)));
+
+        //! access follows from the parameters
+        EXPECT_TRUE(scheduler.access(twice).writes.test(CompA::id));
+        EXPECT_TRUE(scheduler.access(sum_b).reads.test(CompB::id));
+        EXPECT_TRUE(scheduler.access(copy).reads.test(CompA::id) && scheduler.access(copy).writes.test(CompB::id));
+        EXPECT_TRUE(scheduler.access(move_d).reads.test(CompC::id));
+        EXPECT_TRUE(scheduler.access(twice).conflicts(scheduler.access(copy)));
+        EXPECT_FALSE(scheduler.access(twice).conflicts(scheduler.access(sum_b)));
+        EXPECT_FALSE(scheduler.access(copy).conflicts(scheduler.access(move_d)));
+        EXPECT_EQ(scheduler.name(sum_b), "sum_b");
+
+        //! conflicting systems keep the order of registration in every run
+        for(int run = 0; run < 3; ++run)
+        {
+            b_sum = 0;
+            scheduler.run();
+            EXPECT_EQ(count, 60000);
+        }
+        world.forEach([](const CompA& a, const CompB& b)
+        {
+            EXPECT_EQ(b.x, a.a);
+        });
+        long long a_sum = 0;
+        world.forEach([&a_sum](const CompA& a, const CompC& c)
+        {
+            a_sum += a.a;
+        });
+        EXPECT_EQ(a_sum, 8 * 20000LL * 19999 / 2 + 7 * 20000); //! ((2a + 1) * 2 + 1) * 2 + 1
+        EXPECT_EQ(b_sum, 20000.0 * (2 * 19999 + 3)); //! sum of b = 4a + 3 copied in the previous run
+        EXPECT_EQ(d_sum, 20000LL * 19999 / 2);
+        world.forEach([](const CompD& d)
+        {
+            EXPECT_EQ(d.y, 3 * d.x);
+        });
+    }
+    TEST(ScheduledChangeFilters, ActionTests)
+    {
+        EntityWorld world;
+        world.setThreadCount(4);
+        auto ids = world.addEntities(20000, CompA{.a=0}, CompB{.x=0}); //! a couple of chunks
+
+        SystemScheduler scheduler(world);
+        auto touch = scheduler.addSystem("touch", SystemAccess{.writes = world.getId<CompB>()}, [&ids](EntityWorld& world)
+        {
+            world.get<CompB>(ids[0]).x += 1;
+        });
+        int seen = 0;
+        auto watch = scheduler.addSystem<Changed<CompB>>("watch", [&seen](const CompA&)
+        {
+            seen++;
+        });
+        bool write_last = false;
+        scheduler.addSystem("late", SystemAccess{.writes = world.getId<CompB>()}, [&](EntityWorld& world)
+        {
+            if(write_last)
+            {
+                world.get<CompB>(ids.back()).x += 1;
+            }
+        });
+
+        //! the filtered component is read, so writers of it never run alongside
+        EXPECT_TRUE(scheduler.access(watch).reads.test(CompB::id));
+        EXPECT_TRUE(scheduler.access(watch).conflicts(scheduler.access(touch)));
+
+        auto run = [&]
+        {
+            seen = 0;
+            scheduler.run();
+            return seen;
+        };
+        EXPECT_EQ(run(), 20000); //! everything is new on the first run
+        auto first_chunk = run();
+        EXPECT_GT(first_chunk, 0);
+        EXPECT_LT(first_chunk, 20000);
+
+        //! a write after the system ran shows up in its next run
+        write_last = true;
+        EXPECT_EQ(run(), first_chunk);
+        write_last = false;
+        EXPECT_GT(run(), first_chunk);
+        EXPECT_EQ(run(), first_chunk);
+    }
+
+    TEST(Profiling, ActionTests)
+    {
+        //! the ring buffer keeps the latest events, oldest first
+        Profiler profiler(4);
+        auto name = profiler.nameId("with \"quotes\"");
+        EXPECT_EQ(profiler.nameId("with \"quotes\""), name);
+        EXPECT_EQ(profiler.name(Profiler::REMOVE_ENTITY), "removeEntity");
+        for(std::uint64_t i = 0; i < 6; ++i)
+        {
+            profiler.record({.name = name, .category = ProfileCategory::Query, .thread = 0, .start = i * 1000, .duration = 1500,
+                             .stats = {.archetypes = 1, .chunks = 2, .rows = i}});
+        }
+        auto events = profiler.events();
+        ASSERT_EQ(events.size(), 4);
+        EXPECT_EQ(events.front().stats.rows, 2);
+        EXPECT_EQ(events.back().stats.rows, 5);
+        EXPECT_EQ(profiler.droppedCount(), 2);
+
+        std::ostringstream trace;
+        profiler.writeChromeTrace(trace);
+        auto json = trace.str();
+        EXPECT_EQ(json.rfind("{\"traceEvents\":[", 0), 0);
+        EXPECT_NE(json.find("\"name\":\"with \\\"quotes\\\"\""), std::string::npos);
+        EXPECT_NE(json.find("\"ph\":\"X\",\"ts\":5.000,\"dur\":1.500"), std::string::npos);
+        EXPECT_NE(json.find("\"args\":{\"archetypes\":1,\"chunks\":2,\"rows\":5}"), std::string::npos);
+        profiler.clear();
+        EXPECT_TRUE(profiler.events().empty());
+
+        //! each thread records into a buffer of its own, events come back merged by start
+        Profiler shared_profiler(1000);
+        std::vector<std::thread> threads;
+        for(int thread_i = 0; thread_i < 4; ++thread_i)
+        {
+            threads.emplace_back([&shared_profiler]
+            {
+                for(int i = 0; i < 1000; ++i)
+                {
+                    ProfileScope scope(shared_profiler, Profiler::FLUSH, ProfileCategory::Structural);
+                }
+            });
+        }
+        for(auto& thread : threads)
+        {
+            thread.join();
+        }
+        auto merged = shared_profiler.events();
+        EXPECT_EQ(merged.size(), 4000);
+        EXPECT_EQ(shared_profiler.droppedCount(), 0);
+        EXPECT_TRUE(std::ranges::is_sorted(merged, {}, &ProfileEvent::start));
+        std::set<std::uint32_t> recording_threads;
+        for(auto& event : merged)
+        {
+            recording_threads.insert(event.thread);
+        }
+        EXPECT_EQ(recording_threads.size(), 4);
+
+        //! queries count what a pass visits
+        EntityWorld world;
+        std::vector<EntityId> ids;
+        for(int i = 0; i < 1000; ++i)
+        {
+            ids.push_back(world.addEntity(CompA{.a=i}, CompB{.x=1}).id);
+            world.addEntity(CompA{.a=i});
+        }
+        int visited = 0;
+        auto stats = world.query<CompA>().forEach([&visited](CompA&) { visited++; });
+        EXPECT_EQ(stats.archetypes, 2);
+        EXPECT_EQ(stats.rows, visited);
+        EXPECT_GE(stats.chunks, 2);
+        auto since = world.advanceTick();
+        world.get<CompB>(ids[0]).x = 2;
+        visited = 0;
+        auto changed = world.query<CompB, Changed<CompB>>().forEach<Changed<CompB>>([&visited](CompB&) { visited++; }, since);
+        EXPECT_EQ(changed.archetypes, 1);
+        EXPECT_EQ(changed.chunks, 1);
+        EXPECT_EQ(changed.rows, visited);
+
+#ifdef ECS_PROFILING
+        world.profiler().clear();
+        world.forEach([](CompA& a) { a.a++; });
+        world.parallelForEach([](CompB& b) { b.x++; });
+        world.addComponent(ids[1], CompC{.x='c'});
+        world.removeEntity(ids[2]);
+        SystemScheduler scheduler(world);
+        scheduler.addSystem("reader", [](const CompB& b) {});
+        scheduler.run();
+
+        auto world_events = world.profiler().events();
+        auto find = [&](const std::string& event_name)
+        {
+            return std::find_if(world_events.begin(), world_events.end(), [&](const ProfileEvent& event)
+            {
+                return world.profiler().name(event.name) == event_name;
+            });
+        };
+        auto query_event = find("query(" + std::to_string(CompA::id) + ")");
+        ASSERT_NE(query_event, world_events.end());
+        EXPECT_EQ(query_event->category, ProfileCategory::Query);
+        EXPECT_EQ(query_event->stats.rows, 2000);
+        auto parallel_event = find("query(" + std::to_string(CompB::id) + ")");
+        ASSERT_NE(parallel_event, world_events.end());
+        EXPECT_EQ(parallel_event->stats.rows, 1000);
+        EXPECT_NE(find("addComponent"), world_events.end());
+        EXPECT_NE(find("removeEntity"), world_events.end());
+        auto system_event = find("reader");
+        ASSERT_NE(system_event, world_events.end());
+        EXPECT_EQ(system_event->category, ProfileCategory::System);
+#endif
+    }
+
+    TEST(ChunkAction, ActionTests)
+    {
+        EntityWorld world;
+        world.setLayout<CompA, CompD>(ChunkLayout::SoA);
+
+        std::unordered_set<EntityId> ids;
+        const int entity_count = COMPONENT_CHUNK_SIZE / 16 + 10; //! last chunk is not full
+        for(int i = 0; i < entity_count; ++i)
+        {
+            ids.insert(world.addEntity(CompA{.a=1}, CompB{.x=5}).id);
+            ids.insert(world.addEntity(CompA{.a=1}, CompD{.x=2, .y=3}).id);
+        }
+
+        std::size_t row_count = 0;
+        world.forEachChunk([&](std::span<const EntityId> chunk_ids, ColumnView<CompA> a_column)
+        {
+            EXPECT_EQ(a_column.size(), chunk_ids.size());
+            for(std::size_t i = 0; i < chunk_ids.size(); ++i)
+            {
+                EXPECT_EQ(&a_column[i], &world.get<CompA>(chunk_ids[i]));
+                EXPECT_TRUE(ids.contains(chunk_ids[i]));
+                a_column[i].a++;
+            }
+            row_count += chunk_ids.size();
+        });
+        EXPECT_EQ(row_count, 2 * entity_count);
+
+        world.forEachChunk([](std::span<const EntityId> chunk_ids, ColumnView<CompD> d_column, ColumnView<CompA> a_column)
+        {
+            EXPECT_TRUE(d_column.contiguous());
+            CompA* a = a_column.data();
+            for(std::size_t i = 0; i < chunk_ids.size(); ++i)
+            {
+                EXPECT_EQ(a[i].a, 2);
+            }
+        });
+    }
     TEST(TaggedAction, ActionTests)
     {
         EntityWorld world;
@@ -274,6 +1600,95 @@ namespace  //! THIS NAMESPACE NEEDS TO BE ANONYMOUS FOR SOME REASON???
         world.forEach(action2);
         EXPECT_EQ(call_count, 2);
     }
+    TEST(ChangeFilters, ActionTests)
+    {
+        EntityWorld world;
+        auto ids = world.addEntities(20000, CompA{.a=0}, CompB{.x=0}); //! a couple of chunks
+
+        int count = 0;
+        auto count_a = [&count](const CompA&){ count++; };
+        auto visited = [&]<class... Filters>(Tick since)
+        {
+            count = 0;
+            world.forEach<Filters...>(count_a, since);
+            return count;
+        };
+
+        EXPECT_EQ(visited.operator()<Added<CompA>>(0), 20000);
+        auto since = world.advanceTick();
+        EXPECT_EQ(visited.operator()<Changed<CompA>>(since), 0); //! read only access does not count
+
+        //! only the chunk of the written entity passes
+        world.get<CompA>(ids[0]).a = 5;
+        auto chunk_size = visited.operator()<Changed<CompA>>(since);
+        EXPECT_GT(chunk_size, 0);
+        EXPECT_LT(chunk_size, 20000);
+        EXPECT_EQ(visited.operator()<Changed<CompB>>(since), 0);
+
+        //! mutable parameters mark all visited chunks
+        since = world.advanceTick();
+        world.forEach([](CompB& b){ b.x = 1; });
+        EXPECT_EQ(visited.operator()<Changed<CompB>>(since), 20000);
+        EXPECT_EQ(visited.operator()<Changed<CompA>>(since), 0);
+        EXPECT_EQ((visited.operator()<Changed<CompA>, Changed<CompB>>(since)), 0);
+
+        //! components moved into another archetype are changed but not added
+        since = world.advanceTick();
+        world.addComponent(ids.back(), CompC{.x='c'});
+        EXPECT_EQ(visited.operator()<Added<CompC>>(since), 1);
+        EXPECT_EQ(visited.operator()<Added<CompA>>(since), 0);
+        EXPECT_EQ(visited.operator()<Changed<CompA>>(since), 1);
+
+        since = world.advanceTick();
+        world.commands().addComponent(ids[1], CompC{.x='d'});
+        world.flush();
+        EXPECT_EQ(visited.operator()<Added<CompC>>(since), 2); //! both in the same chunk
+    }
+
+    TEST(ExcludedOptionalAction, ActionTests)
+    {
+        EntityWorld world;
+        world.addEntity(CompA{.a=1});
+        world.addEntity(CompA{.a=2}, CompB{.x=2});
+        world.addEntity(CompA{.a=3}, CompC{.x='c'});
+        world.addEntity(CompA{.a=4}, CompB{.x=4}, CompC{.x='c'});
+
+        int sum = 0;
+        world.forEach<Without<CompC>>([&sum](const CompA& a){ sum += a.a; });
+        EXPECT_EQ(sum, 1 + 2);
+
+        int with_b = 0;
+        int without_b = 0;
+        world.forEach([&](CompA& a, CompB* b)
+        {
+            if(b)
+            {
+                EXPECT_FLOAT_EQ(b->x, a.a);
+                b->x++;
+                with_b++;
+            }
+            else
+            {
+                without_b++;
+            }
+        });
+        EXPECT_EQ(with_b, 2);
+        EXPECT_EQ(without_b, 2);
+
+        //! the exclusion is part of the cached query
+        auto& query = world.query<CompA, Optional<CompB>, Without<CompC>>();
+        auto& plain_query = world.query<CompA>();
+        EXPECT_EQ(query.archetypeCount(), 2);
+        EXPECT_EQ(plain_query.archetypeCount(), 4);
+        world.addEntity(CompA{.a=5}, CompD{});
+        world.addEntity(CompA{.a=6}, CompC{}, CompD{});
+        EXPECT_EQ(query.archetypeCount(), 3);
+
+        sum = 0;
+        query.forEach([&sum](CompA& a, CompB* b){ sum += a.a + (b ? (int)b->x : 0); });
+        EXPECT_EQ(sum, 1 + 2 + 3 + 5);
+    }
+
     TEST(SwappedParametersAction, ActionTests)
     {
         EntityWorld world;